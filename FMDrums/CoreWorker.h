@@ -0,0 +1,75 @@
+/*
+* CoreWorker - hands a job from the audio task to a task on the second core
+*
+* The audio task (core 0) posts a job and later joins it; a worker task on
+* core 1 runs it and publishes the result. A two-party barrier on a pair of
+* sequence numbers, with no mutex: post() releases the job with seq_, the
+* worker releases the result with done_, and join() spins until done_ catches
+* up. One job is in flight at a time.
+*
+* FmDrumSynth uses two of them: the voice split (posted and joined within the
+* block, see renderVoices()) and the pipelined reverb (joined one block later).
+*
+* How the worker gets woken is up to the platform: FMDrums.ino gives a
+* FreeRTOS task notification as the kick, the host renderer polls from a thread.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#if !defined(ARDUINO)
+#include <thread>
+#endif
+
+template<typename Job>
+class CoreWorker {
+public:
+    using KickFn = void (*)();
+
+    // set before the audio task starts; nullptr means no worker
+    void attach(KickFn kick) { kick_ = kick; }
+    inline bool attached() const { return kick_ != nullptr; }
+
+    // --- audio task ---
+
+    void post(const Job& job) {
+        job_ = job;
+        posted_ = seq_.load(std::memory_order_relaxed) + 1;
+        seq_.store(posted_, std::memory_order_release);
+        kick_();
+    }
+
+    // waits for the job of the last post(), returns its result; at once if none is out
+    uint32_t join() {
+        while (done_.load(std::memory_order_acquire) != posted_) {
+#if !defined(ARDUINO)
+            std::this_thread::yield();   // the host may not give the worker a core of its own
+#endif
+        }
+        return result_;
+    }
+
+    // --- worker task ---
+
+    // runs the pending job, if any, through fn(const Job&) -> uint32_t
+    template<typename Fn>
+    bool run(Fn&& fn) {
+        const uint32_t seq = seq_.load(std::memory_order_acquire);
+        if (seq == done_.load(std::memory_order_relaxed)) return false;
+        result_ = fn(job_);
+        done_.store(seq, std::memory_order_release);
+        return true;
+    }
+
+private:
+    KickFn kick_ = nullptr;
+    Job job_ = {};
+    uint32_t result_ = 0;
+    uint32_t posted_ = 0;                  // audio task only
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint32_t> done_{0};
+};
@@ -3,65 +3,97 @@
 #include <stdint.h>
 #include "FmVoice6.h"
 
+// Besides picking voices, the allocator keeps the set of live voices: a bitmask plus
+// the same indices as a compacted list, so that render, mix and allocation only
+// visit the 2-4 voices that are usually sounding instead of all MAX_VOICES.
+// A voice enters the set on voiceStarted() and leaves it in updateActive() once its
+// envelope has gone idle; in between the set may still hold voices that just ended.
+//
+// Note-on and note-off do not scan the pool: the set is indexed by note and by choke
+// group (a voice mask each), and free voices are the bits outside the set. What they
+// still loop over is the voices of one note or one choke group. Only a steal, with
+// every voice taken, visits the whole set: it drops the voices that ended earlier in
+// this block first, so that one of those is reused rather than a sounding voice stolen.
+//
+// With VOICE_COST_BUDGET the set also has a CPU budget: the render costs of its voices
+// (FmVoice6::getRenderCost()) may not add up to more after any note-on, so many cheap
+// hats fit where only a few filtered six-operator toms do. A voice faded out for the
+// budget (FmVoice6::fadeOut(), END_FAST, 0.5 ms) still renders until its envelope is
+// idle, up to a block later, and keeps its cost in the set until then. So fitBudget()
+// fades voices, cheapest to lose first (getStealScore()), from FadeReserve below the
+// budget, which leaves room for the voices a block starts while the ones they replace
+// fade. Only past the budget itself does it end voices at once, fading ones first.
+//
+// The cost units are FmVoice6::renderCostTable, the dearest renderer costing 60, and
+// the budget of 600 is 10 of those, the polyphony the board has always run at. Both
+// are host estimates (host/bench.cpp): the board's VoiceBench run prints its own table
+// and the VOICE_COST_BUDGET that keeps the voices within 70% of the sample period.
 class IRAM_ATTR DrumVoiceAllocator {
+    static_assert(MAX_VOICES <= 32, "active voice set is one 32-bit mask");
+
 public:
+    static constexpr int NumChokeGroups = 256;   // FmDrumPatch::chokeGroup is a byte
+#ifdef VOICE_COST_BUDGET
+    static constexpr int FadeReserve = 2 * FmVoice6::MaxRenderCost;  // two of the dearest voices fading
+    static_assert(VOICE_COST_BUDGET >= FadeReserve + FmVoice6::MaxRenderCost, "no room below the fade reserve");
+#endif
+
     void init(FmVoice6* voices, int numVoices) {
         voicePool = voices;
         poolSize = (numVoices > MAX_VOICES) ? MAX_VOICES : numVoices;
+        poolMask_ = (poolSize >= 32) ? ~0u : ((1u << poolSize) - 1);
+        activeMask_ = 0;
+        numActive_ = 0;
+        activeCost_ = 0;
+#ifdef VOICE_COST_BUDGET
+        fadingMask_ = 0;
+        fadingCost_ = 0;
+#endif
+        for (auto& m : noteMask_) m = 0;
+        for (auto& m : chokeMask_) m = 0;
     }
 
     int allocateVoice(uint8_t midiNote, uint8_t chokeId) {
-        int activeForNote = 0;
-
         // Choke any voices in the same group
         if (chokeId > 0) {
-            for (int i = 0; i < poolSize; ++i) {
-                if (voicePool[i].isActive() && voicePool[i].getChokeGroup() == chokeId) {
-                    voicePool[i].noteChoke();
-                }
+            for (uint32_t m = chokeMask_[chokeId] & ~fadingMask(); m; m &= m - 1) {
+                const int i = __builtin_ctz(m);
+                if (voicePool[i].isActive()) voicePool[i].noteChoke();
             }
         }
 
-        // Count existing voices playing this note
-        for (int i = 0; i < poolSize; ++i) {
-            if (voicePool[i].isActive() && voicePool[i].getNote() == midiNote) {
-                ++activeForNote;
+        // Enforce per-note polyphony: steal the least important voice of this note
+        int activeForNote = 0;
+        float worstScore = -1.f;
+        int worstIndex = -1;
+        for (uint32_t m = noteMask_[midiNote & 127]; m; m &= m - 1) {
+            const int i = __builtin_ctz(m);
+            if (!voicePool[i].isActive()) continue;
+            ++activeForNote;
+            float score = voicePool[i].getStealScore();
+            if (score > worstScore) {
+                worstScore = score;
+                worstIndex = i;
             }
         }
+        if (activeForNote >= MAX_VOICES_PER_NOTE) return worstIndex;
 
-        // Enforce per-note polyphony
-        if (activeForNote >= MAX_VOICES_PER_NOTE) {
-            // Find the least important voice for this note to steal
-            float worstScore = -1.f;
-            int worstIndex = -1;
-            for (int i = 0; i < poolSize; ++i) {
-                if (voicePool[i].isActive() && voicePool[i].getNote() == midiNote) {
-                    float score = voicePool[i].getStealScore();
-                    if (score > worstScore) {
-                        worstScore = score;
-                        worstIndex = i;
-                    }
-                }
-            }
-            if (worstIndex >= 0) {
-                return worstIndex;
-            } else {
-                ESP_LOGW("Allocator", "Note %d dropped (max voices per note)", midiNote);
-                return -1;
-            }
+        // Free voice: the lowest one not in the set
+        if (const uint32_t free = poolMask_ & ~activeMask_) {
+            return __builtin_ctz(free);
         }
 
-        // Find free voice
-        for (int i = 0; i < poolSize; ++i) {
-            if (!voicePool[i].isActive()) {
-                return i;
-            }
+        // All taken as of the last update; from here on the set is exact
+        updateActive();
+        if (const uint32_t free = poolMask_ & ~activeMask_) {
+            return __builtin_ctz(free);
         }
 
         // Steal least important voice globally
-        float worstScore = -1.f;
-        int worstIndex = -1;
-        for (int i = 0; i < poolSize; ++i) {
+        worstScore = -1.f;
+        worstIndex = -1;
+        for (int n = 0; n < numActive_; ++n) {
+            int i = activeList_[n];
             float score = voicePool[i].getStealScore();
             if (score > worstScore) {
                 worstScore = score;
@@ -71,23 +103,71 @@ public:
         return worstIndex >= 0 ? worstIndex : 0;
     }
 
-    void releaseNote(uint8_t midiNote) {
-        for (int i = 0; i < poolSize; ++i) {
-            if (voicePool[i].getNote() == midiNote) { 
+    // note-off for the voices playing midiNote, returns how many there were
+    int releaseNote(uint8_t midiNote) {
+        int n = 0;
+        for (uint32_t m = noteMask_[midiNote & 127] & ~fadingMask(); m; m &= m - 1) {
+            const int i = __builtin_ctz(m);
+            if (voicePool[i].isActive()) {
                 voicePool[i].noteOff();
+                ++n;
             }
         }
+        return n;
     }
 
     int getActiveVoiceForNote(uint8_t note) {
-        for (int i = 0; i < poolSize; ++i) {
-            if (voicePool[i].isActive() && voicePool[i].getNote() == note) {
-                return i;
-            }
+        for (uint32_t m = noteMask_[note & 127]; m; m &= m - 1) {
+            const int i = __builtin_ctz(m);
+            if (voicePool[i].isActive()) return i;
         }
         return -1;
     }
 
+    // --- active voice set, audio task only ---
+
+    // call after noteOn() of the voice returned by allocateVoice()
+    void voiceStarted(int idx) {
+        uint32_t bit = 1u << idx;
+        if (activeMask_ & bit) unlink(idx);   // stolen: it leaves its old note and group
+        link(idx);
+        if (!(activeMask_ & bit)) {
+            activeMask_ |= bit;
+            rebuildList();
+        }
+#ifdef VOICE_COST_BUDGET
+        if (activeCost_ - fadingCost_ > VOICE_COST_BUDGET - FadeReserve || activeCost_ > VOICE_COST_BUDGET) fitBudget(idx);
+        if (activeCost_ > peakCost_) peakCost_ = activeCost_;
+#endif
+    }
+
+    // drops the voices whose envelope has finished; once per block is enough
+    void updateActive() {
+        uint32_t mask = activeMask_;
+        for (int n = 0; n < numActive_; ++n) {
+            int i = activeList_[n];
+            if (!voicePool[i].isActive()) {
+                mask &= ~(1u << i);
+                unlink(i);
+            }
+        }
+        if (mask != activeMask_) {
+            activeMask_ = mask;
+            rebuildList();
+        }
+    }
+
+    inline uint32_t activeMask() const { return activeMask_; }
+    inline int activeCount() const { return numActive_; }
+    inline const uint8_t* activeList() const { return activeList_; }
+
+    inline int activeCost() const { return activeCost_; }
+#ifdef VOICE_COST_BUDGET
+    inline int peakCost() const { return peakCost_; }            // highest activeCost() after a note-on, fading voices included
+    inline uint32_t budgetFades() const { return budgetFades_; } // voices faded out for the budget
+    inline uint32_t budgetCuts() const { return budgetCuts_; }   // voices ended at once, the fades not being enough
+#endif
+
     uint8_t getNoteForVoice(int voiceIndex) {
         if (voiceIndex >= 0 && voiceIndex < poolSize) {
             return voicePool[voiceIndex].getNote();
@@ -96,6 +176,103 @@ public:
     }
 
 private:
+    // ascending voice order, the order the voices are mixed in
+    void rebuildList() {
+        int n = 0;
+        for (uint32_t m = activeMask_; m; m &= m - 1) {
+            activeList_[n++] = (uint8_t)__builtin_ctz(m);
+        }
+        numActive_ = n;
+    }
+
+    // the note, choke group and cost a voice is filed under, as of its voiceStarted()
+    void link(int idx) {
+        voiceNote_[idx] = voicePool[idx].getNote() & 127;
+        voiceChoke_[idx] = voicePool[idx].getChokeGroup();
+        voiceCost_[idx] = voicePool[idx].getRenderCost();
+        noteMask_[voiceNote_[idx]] |= (1u << idx);
+        chokeMask_[voiceChoke_[idx]] |= (1u << idx);
+        activeCost_ += voiceCost_[idx];
+    }
+
+    void unlink(int idx) {
+        noteMask_[voiceNote_[idx]] &= ~(1u << idx);
+        chokeMask_[voiceChoke_[idx]] &= ~(1u << idx);
+        activeCost_ -= voiceCost_[idx];
+#ifdef VOICE_COST_BUDGET
+        if (fadingMask_ & (1u << idx)) {
+            fadingMask_ &= ~(1u << idx);
+            fadingCost_ -= voiceCost_[idx];
+        }
+#endif
+    }
+
+    // the voices fitBudget() fades out: note-off and choke would slow the fade down
+    inline uint32_t fadingMask() const {
+#ifdef VOICE_COST_BUDGET
+        return fadingMask_;
+#else
+        return 0;
+#endif
+    }
+
+#ifdef VOICE_COST_BUDGET
+    // fades out voices other than keep until the voices not fading are FadeReserve below
+    // the budget, then ends voices until all of them, fading ones included, are within it
+    void fitBudget(int keep) {
+        updateActive();   // voices that ended in this block cost nothing any more
+        while (activeCost_ - fadingCost_ > VOICE_COST_BUDGET - FadeReserve) {
+            const int i = leastImportant(keep, fadingMask_);
+            if (i < 0) break;
+            voicePool[i].fadeOut();
+            fadingMask_ |= 1u << i;
+            fadingCost_ += voiceCost_[i];
+            ++budgetFades_;
+        }
+        while (activeCost_ > VOICE_COST_BUDGET) {
+            int i = leastImportant(keep, ~fadingMask_);
+            if (i < 0) i = leastImportant(keep, 0);
+            if (i < 0) break;
+            voicePool[i].retire();
+            updateActive();     // takes it and its cost out of the set
+            ++budgetCuts_;
+        }
+    }
+
+    // the voice with the highest getStealScore() but keep and those in skip, -1 if none
+    int leastImportant(int keep, uint32_t skip) const {
+        float worstScore = -1.f;
+        int worstIndex = -1;
+        for (int n = 0; n < numActive_; ++n) {
+            int i = activeList_[n];
+            if (i == keep || (skip & (1u << i))) continue;
+            float score = voicePool[i].getStealScore();
+            if (score > worstScore) {
+                worstScore = score;
+                worstIndex = i;
+            }
+        }
+        return worstIndex;
+    }
+#endif
+
     FmVoice6* voicePool = nullptr;
     int poolSize = 0;
+    uint32_t poolMask_ = 0;
+    uint32_t activeMask_ = 0;
+    int numActive_ = 0;
+    uint8_t activeList_[32];    // one slot per mask bit
+    int activeCost_ = 0;        // sum of voiceCost_[] over the set
+#ifdef VOICE_COST_BUDGET
+    uint32_t fadingMask_ = 0;   // voices fading out for the budget, still in the set
+    int fadingCost_ = 0;        // their voiceCost_[]
+    int peakCost_ = 0;
+    uint32_t budgetFades_ = 0;
+    uint32_t budgetCuts_ = 0;
+#endif
+    uint8_t voiceNote_[32] = {};
+    uint8_t voiceChoke_[32] = {};
+    uint8_t voiceCost_[32] = {};
+    uint32_t noteMask_[128] = {};
+    uint32_t chokeMask_[NumChokeGroups] = {};
 };
@@ -3,12 +3,17 @@
 #include <Arduino.h>
 #include <FS.h>
 #include <vector>
+#include <functional>
 #include <ArduinoJson.h>
 #include "FmPatch.h"
+#include "KitFormat.h"
 #include "esp_log.h"
 
 namespace DrumkitStorage {
 
+// called while a kit is written, with the number of patches done so far
+using Progress = std::function<void(int done)>;
+
  
 
 inline void serializePatch(JsonObject obj, const FmDrumPatch& patch) {
@@ -100,30 +105,60 @@ inline bool loadSinglePatch(fs::FS& fs, const char* path, FmDrumPatch& outPatch)
     return true;
 }
 
-inline bool saveDrumkit(fs::FS& fs, const char* path, FmDrumPatch patches[128], const FxReverb& reverb) {
-    DynamicJsonDocument doc(65536);
-    JsonObject root = doc.to<JsonObject>();
+// --- JSON kits: for exchange with the PC and older firmware ---
 
-    // Add reverb params
-    root["reverbTime"] = reverb.getTime();
-    root["reverbLevel"] = reverb.getLevel();
-    root["reverbDamp"] = reverb.getDamping();
-    root["reverbPreDelay"] = reverb.getPreDelayTime();
+inline bool writeAll(File& f, const char* text, size_t len) {
+    return f.write((const uint8_t*)text, len) == len;
+}
 
-    JsonArray patchArray = root.createNestedArray("patches");
-    for (int i = 0; i < 128; ++i) {
-        JsonObject obj = patchArray.createNestedObject();
-        serializePatch(obj, patches[i]);
+inline bool writeText(File& f, const char* text) { return writeAll(f, text, strlen(text)); }
+
+// text with every line after the first moved right by indent spaces
+inline bool writeIndented(File& f, const char* text, size_t len, int indent) {
+    static const char spaces[] = "        ";
+    bool ok = true;
+    size_t start = 0;
+    for (size_t i = 0; i < len && ok; ++i) {
+        if (text[i] != '\n') continue;
+        ok = writeAll(f, text + start, i + 1 - start) && writeAll(f, spaces, indent);
+        start = i + 1;
     }
+    return ok && writeAll(f, text + start, len - start);
+}
 
+// Written one patch at a time in the layout serializeJsonPretty() gives the whole
+// kit, so only a single patch is ever held as a JSON document.
+inline bool saveDrumkitJson(fs::FS& fs, const char* path, const FmDrumPatch patches[128], const ReverbSettings& reverb,
+                            const Progress& progress = nullptr) {
     File f = fs.open(path, FILE_WRITE);
     if (!f) return false;
-    serializeJsonPretty(doc, f);
+
+    char buf[2048];
+    StaticJsonDocument<256> head;
+    head["reverbTime"] = reverb.getTime();
+    head["reverbLevel"] = reverb.getLevel();
+    head["reverbDamp"] = reverb.getDamping();
+    head["reverbPreDelay"] = reverb.getPreDelayTime();
+    size_t n = serializeJsonPretty(head, buf, sizeof(buf));
+    bool ok = writeAll(f, buf, n - 2);                     // up to the closing "\n}"
+    ok = ok && writeText(f, ",\n  \"patches\": [\n    ");
+
+    DynamicJsonDocument doc(1024);
+    for (int i = 0; i < 128 && ok; ++i) {
+        const FmDrumPatch patch = patches[i];   // the GUI may be editing it
+        doc.clear();
+        serializePatch(doc.to<JsonObject>(), patch);
+        n = serializeJsonPretty(doc, buf, sizeof(buf));
+        ok = writeIndented(f, buf, n, 4) && writeText(f, i < 127 ? ",\n    " : "\n");
+        if (progress) progress(i + 1);
+    }
+    ok = ok && writeText(f, "  ]\n}");
     f.close();
-    return true;
+    if (!ok) ESP_LOGE("DrumkitStorage", "Short write to %s", path);
+    return ok;
 }
 
-inline bool loadDrumkit(fs::FS& fs, const char* path, FmDrumPatch patches[128], FxReverb& reverb) {
+inline bool loadDrumkitJson(fs::FS& fs, const char* path, FmDrumPatch patches[128], ReverbSettings& reverb) {
     File f = fs.open(path, FILE_READ);
     if (!f) return false;
 
@@ -150,6 +185,305 @@ inline bool loadDrumkit(fs::FS& fs, const char* path, FmDrumPatch patches[128],
     return true;
 }
 
+// --- binary kits (.fmk), see KitFormat.h ---
+
+// Each distinct patch goes out once, packed if that loses nothing, as a copy
+// taken just before; the CRC is taken over what was written, and the mask and
+// header go last: a patch edited meanwhile cannot leave a file failing its CRC.
+inline bool saveDrumkitBinary(fs::FS& fs, const char* path, const FmDrumPatch patches[128], const ReverbSettings& reverb,
+                              const Progress& progress = nullptr, uint32_t generation = 0) {
+    File f = fs.open(path, FILE_WRITE);
+    if (!f) return false;
+
+    uint8_t index[KitFormat::NumPatches], first[KitFormat::NumPatches];
+    const int n = KitFormat::buildIndex(patches, index, first);
+
+    KitFormat::Header h = {};
+    uint8_t mask[KitFormat::MaskSize] = {};
+    bool ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&     // placeholders
+              f.write(index, KitFormat::IndexSize) == KitFormat::IndexSize &&
+              f.write(mask, KitFormat::MaskSize) == KitFormat::MaskSize;
+    uint32_t crc = KitFormat::crc32(index, KitFormat::IndexSize);
+    for (int k = 0; k < n && ok; ++k) {
+        FmDrumPatch patch;
+        memcpy(&patch, &patches[first[k]], sizeof(patch));
+        PackedPatch packed;
+        const uint8_t* record = (const uint8_t*)&patch;
+        size_t size = sizeof(patch);
+        if (packPatch(patch, packed)) {
+            mask[k >> 3] |= 1 << (k & 7);
+            record = (const uint8_t*)&packed;
+            size = sizeof(packed);
+        }
+        crc = KitFormat::crc32(record, size, crc);
+        ok = f.write(record, size) == size;
+        if (progress) progress((k + 1) * 128 / n);
+    }
+    crc = KitFormat::crc32(mask, KitFormat::MaskSize, crc);
+    h = KitFormat::makeHeader(n, crc, reverb.getTime(), reverb.getLevel(), reverb.getDamping(), reverb.getPreDelayTime(),
+                              generation);
+    ok = ok && f.seek(0) && f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+         f.seek(sizeof(h) + KitFormat::IndexSize) && f.write(mask, KitFormat::MaskSize) == KitFormat::MaskSize;
+    f.close();
+    if (!ok) ESP_LOGE("DrumkitStorage", "Short write to %s", path);
+    return ok;
+}
+
+// Index, records and mask are checked against their CRC first, the records in
+// small chunks, so a damaged file leaves patches[] as it was; then the records
+// are read into the top of patches[] with one read(), unpacked, and copied out
+// to the notes that share them.
+inline bool loadDrumkitBinary(fs::FS& fs, const char* path, FmDrumPatch patches[128], ReverbSettings& reverb,
+                              uint32_t* generation = nullptr) {
+    File f = fs.open(path, FILE_READ);
+    if (!f) return false;
+
+    uint8_t raw[sizeof(KitFormat::Header)];
+    const size_t got = f.read(raw, sizeof(raw));
+    KitFormat::Header h;
+    if (!KitFormat::readHeader(raw, got, h) || !f.seek(h.headerSize)) {
+        f.close();
+        ESP_LOGE("DrumkitStorage", "%s is not a version %d kit of this build", path, KitFormat::Version);
+        return false;
+    }
+
+    const size_t indexSize = KitFormat::hasIndex(h) ? KitFormat::IndexSize : 0;
+    const size_t maskSize = KitFormat::hasMask(h) ? KitFormat::MaskSize : 0;
+    uint8_t index[KitFormat::NumPatches];
+    uint8_t mask[KitFormat::MaskSize] = {};         // before version 3: all float records
+    for (int i = 0; i < 128; ++i) index[i] = i;     // version 1: all 128
+    bool ok = f.read(index, indexSize) == indexSize && f.read(mask, maskSize) == maskSize &&
+              KitFormat::checkIndex(index, h.numPatches);
+
+    const size_t recordSize = KitFormat::recordBytes(h.numPatches, mask);
+    uint8_t chunk[256];
+    uint32_t crc = KitFormat::crc32(index, indexSize);
+    size_t left = recordSize;
+    while (ok && left > 0) {
+        size_t n = left < sizeof(chunk) ? left : sizeof(chunk);
+        if (f.read(chunk, n) != n) break;
+        crc = KitFormat::crc32(chunk, n, crc);
+        left -= n;
+    }
+    crc = KitFormat::crc32(mask, maskSize, crc);
+    if (!ok || left > 0 || crc != h.patchCrc) {
+        f.close();
+        ESP_LOGE("DrumkitStorage", "%s is damaged", path);
+        return false;
+    }
+
+    uint8_t* top = (uint8_t*)patches + KitFormat::TableSize - recordSize;
+    ok = f.seek(h.headerSize + indexSize + maskSize) && f.read(top, recordSize) == recordSize;
+    f.close();
+    if (!ok) return false;
+    KitFormat::decodeRecords(patches, h.numPatches, mask);
+    KitFormat::expandTable(patches, index);
+    for (int i = 0; i < 128; ++i) patches[i].name[sizeof(patches[i].name) - 1] = '\0';
+
+    reverb.setTime(h.reverbTime);
+    reverb.setLevel(h.reverbLevel);
+    reverb.setDamping(h.reverbDamp);
+    reverb.setPreDelayTime(h.reverbPreDelay);
+    if (generation) *generation = h.generation;
+    return true;
+}
+
+// by extension: *.fmk binary, anything else JSON
+inline bool saveDrumkit(fs::FS& fs, const char* path, const FmDrumPatch patches[128], const ReverbSettings& reverb,
+                        const Progress& progress = nullptr) {
+    return KitFormat::hasExtension(path) ? saveDrumkitBinary(fs, path, patches, reverb, progress)
+                                         : saveDrumkitJson(fs, path, patches, reverb, progress);
+}
+
+inline bool loadDrumkit(fs::FS& fs, const char* path, FmDrumPatch patches[128], ReverbSettings& reverb) {
+    return KitFormat::hasExtension(path) ? loadDrumkitBinary(fs, path, patches, reverb)
+                                         : loadDrumkitJson(fs, path, patches, reverb);
+}
+
+inline String drumkitPath(const char* dir, const String& name, const char* ext) {
+    return String(dir) + "/" + name + ext;
+}
+
+// --- journal (.fmj), see KitFormat.h ---
+
+// the header of a journal this build can replay
+inline bool readJournalHeader(File& f, KitFormat::JournalHeader& h) {
+    return f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && KitFormat::checkJournalHeader(h);
+}
+
+// the generation of a kit file, 0 if there is none that loads
+inline uint32_t kitGeneration(fs::FS& fs, const String& path) {
+    if (!fs.exists(path)) return 0;
+    File f = fs.open(path, FILE_READ);
+    if (!f) return 0;
+    uint8_t raw[sizeof(KitFormat::Header)];
+    const size_t got = f.read(raw, sizeof(raw));
+    f.close();
+    KitFormat::Header h;
+    return KitFormat::readHeader(raw, got, h) ? h.generation : 0;
+}
+
+// the generation for a kit file about to replace bin: above that of bin and of
+// its journal, so that the journal no longer matches
+inline uint32_t nextGeneration(fs::FS& fs, const String& bin, const String& journal) {
+    uint32_t g = kitGeneration(fs, bin);
+    if (fs.exists(journal)) {
+        File f = fs.open(journal, FILE_READ);
+        KitFormat::JournalHeader h;
+        if (f && readJournalHeader(f, h) && h.generation > g) g = h.generation;
+        f.close();
+    }
+    return g + 1;
+}
+
+// Appends a record for each note set in notes[] (128 bits, note 0 in bit 0 of
+// notes[0]) and one for reverb, if given, on top of the kit file of the given
+// generation; a journal of another one is started over. Returns the number of
+// records the journal holds afterwards, -1 if it could not be written.
+inline int appendJournal(fs::FS& fs, const char* path, uint32_t generation, const FmDrumPatch patches[128],
+                         const uint32_t notes[4], const ReverbSettings* reverb) {
+    bool fresh = true;
+    if (fs.exists(path)) {
+        File old = fs.open(path, FILE_READ);
+        KitFormat::JournalHeader h;
+        fresh = !(old && readJournalHeader(old, h) && h.generation == generation);
+        old.close();
+    }
+    File f = fs.open(path, fresh ? FILE_WRITE : FILE_APPEND);
+    if (!f) return -1;
+
+    bool ok = true;
+    if (fresh) {
+        KitFormat::JournalHeader h = KitFormat::makeJournalHeader(generation);
+        ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h);
+    }
+    for (int i = 0; i < 128 && ok; ++i) {
+        if (!(notes[i >> 5] & (1u << (i & 31)))) continue;
+        KitFormat::JournalRecord r = KitFormat::makePatchRecord(i, patches[i]);
+        ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+    }
+    if (reverb && ok) {
+        const float s[4] = { reverb->getTime(), reverb->getLevel(), reverb->getDamping(), reverb->getPreDelayTime() };
+        KitFormat::JournalRecord r = KitFormat::makeReverbRecord(s);
+        ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+    }
+    const size_t size = f.size();
+    f.close();
+    if (!ok) {
+        ESP_LOGE("DrumkitStorage", "Short write to %s", path);
+        return -1;
+    }
+    return (size - sizeof(KitFormat::JournalHeader)) / sizeof(KitFormat::JournalRecord);
+}
+
+// Applies the records of a journal in order and returns how many; stops at the
+// first one that fails its CRC, which is where a write was cut short. -1, with
+// nothing applied, if the journal is not one of the kit file of that generation.
+inline int replayJournal(fs::FS& fs, const char* path, uint32_t generation, FmDrumPatch patches[128],
+                         ReverbSettings& reverb) {
+    File f = fs.open(path, FILE_READ);
+    if (!f) return 0;
+
+    KitFormat::JournalHeader h;
+    if (!readJournalHeader(f, h)) {
+        f.close();
+        ESP_LOGE("DrumkitStorage", "%s is not a version %d journal of this build", path, KitFormat::JournalVersion);
+        return -1;
+    }
+    if (h.generation != generation) {
+        f.close();
+        ESP_LOGW("DrumkitStorage", "%s is of kit generation %u, the kit file is %u", path, (unsigned)h.generation,
+                 (unsigned)generation);
+        return -1;
+    }
+
+    int applied = 0;
+    KitFormat::JournalRecord r;
+    while (f.read((uint8_t*)&r, sizeof(r)) == sizeof(r)) {
+        if (r.crc != KitFormat::recordCrc(r)) {
+            ESP_LOGW("DrumkitStorage", "%s: record %d is damaged, the rest is dropped", path, applied);
+            break;
+        }
+        if (r.kind == KitFormat::PatchRecord && r.note < 128) {
+            memcpy(&patches[r.note], r.payload, sizeof(FmDrumPatch));
+            patches[r.note].name[sizeof(patches[r.note].name) - 1] = '\0';
+        } else if (r.kind == KitFormat::ReverbRecord) {
+            float s[4];
+            memcpy(s, r.payload, sizeof(s));
+            reverb.setTime(s[0]);
+            reverb.setLevel(s[1]);
+            reverb.setDamping(s[2]);
+            reverb.setPreDelayTime(s[3]);
+        }
+        ++applied;
+    }
+    f.close();
+    return applied;
+}
+
+// Writes <dir>/<name>.fmk: the new file goes to .fmk.tmp first, replaces the
+// old one, and then the journal it supersedes is deleted. A power loss before
+// the replace leaves the old kit and its journal; after it, the new kit (as
+// .fmk, or as .fmk.tmp, which loadDrumkitByName() takes up) and maybe the old
+// journal, which has the old generation and is dropped when the kit loads.
+// This is the compaction step as well as the plain save; generation: the new one.
+inline bool writeDrumkit(fs::FS& fs, const char* dir, const String& name, const FmDrumPatch patches[128],
+                         const ReverbSettings& reverb, const Progress& progress = nullptr,
+                         uint32_t* generation = nullptr) {
+    const String bin = drumkitPath(dir, name, KitFormat::Extension);
+    const String tmp = bin + ".tmp";
+    const String journal = drumkitPath(dir, name, KitFormat::JournalExtension);
+    const uint32_t next = nextGeneration(fs, bin, journal);
+    if (!saveDrumkitBinary(fs, tmp.c_str(), patches, reverb, progress, next)) {
+        fs.remove(tmp);
+        return false;
+    }
+    if (fs.exists(bin)) fs.remove(bin);
+    if (!fs.rename(tmp, bin)) {
+        ESP_LOGE("DrumkitStorage", "Cannot rename %s", tmp.c_str());
+        return false;
+    }
+    if (fs.exists(journal)) fs.remove(journal);
+    if (generation) *generation = next;
+    return true;
+}
+
+// Loads <dir>/<name>.fmk and replays <name>.fmj over it, if there is one. A kit
+// that only exists as <name>.json (copied over from the PC, or saved by older
+// firmware) is imported, and written as .fmk for the next time. To re-import an
+// edited .json, delete its .fmk. A journal of another kit file generation is
+// deleted unread. generation: that of the kit file, for appendJournal().
+inline bool loadDrumkitByName(fs::FS& fs, const char* dir, const String& name, FmDrumPatch patches[128], ReverbSettings& reverb,
+                              uint32_t* generation = nullptr) {
+    String bin = drumkitPath(dir, name, KitFormat::Extension);
+    String tmp = bin + ".tmp";
+    String journal = drumkitPath(dir, name, KitFormat::JournalExtension);
+    if (!fs.exists(bin) && fs.exists(tmp)) fs.rename(tmp, bin);    // writeDrumkit() cut short
+
+    uint32_t gen = 0;
+    bool ok = fs.exists(bin) && loadDrumkitBinary(fs, bin.c_str(), patches, reverb, &gen);
+    if (!ok) {
+        String json = drumkitPath(dir, name, ".json");
+        if (!loadDrumkitJson(fs, json.c_str(), patches, reverb)) return false;
+        gen = nextGeneration(fs, bin, journal);     // a journal there was not kept on top of the .json
+        if (saveDrumkitBinary(fs, bin.c_str(), patches, reverb, nullptr, gen)) {
+            ESP_LOGI("DrumkitStorage", "Imported %s as %s", json.c_str(), bin.c_str());
+        }
+    }
+
+    if (fs.exists(journal)) {
+        int n = replayJournal(fs, journal.c_str(), gen, patches, reverb);
+        if (n >= 0) {
+            ESP_LOGI("DrumkitStorage", "Replayed %d edits from %s", n, journal.c_str());
+        } else {
+            fs.remove(journal);
+            ESP_LOGW("DrumkitStorage", "Dropped %s", journal.c_str());
+        }
+    }
+    if (generation) *generation = gen;
+    return true;
+}
+
 
 inline std::vector<String> listDrumkits(fs::FS& fs, const char* dir) {
     std::vector<String> kits;
@@ -167,11 +501,18 @@ inline std::vector<String> listDrumkits(fs::FS& fs, const char* dir) {
         String lower = name;
         lower.toLowerCase();
 
-        if (lower.endsWith(".json")) {
+        int extLen = 0;
+        if (lower.endsWith(".json")) extLen = 5;
+        else if (lower.endsWith(KitFormat::Extension)) extLen = strlen(KitFormat::Extension);
+
+        if (extLen > 0) {
             if (name.startsWith(dir)) {
                 name.remove(0, String(dir).length());
             }
-            name.remove(name.length() - 5); // remove ".json"
+            name.remove(name.length() - extLen); // remove the extension
+            bool known = false;
+            for (const auto& k : kits) known = known || (k == name);
+            if (known) continue;            // both a .fmk and a .json
             kits.push_back(name);
             ESP_LOGI("DrumkitStorage", "Drumkit added: %s", name.c_str());
         }
@@ -0,0 +1,64 @@
+/*
+* EventQueue - lock-free single-producer / single-consumer ring
+*
+* Carries note events from the MIDI task (core 1) to the audio task (core 0),
+* so that voices and the allocator are only ever touched by the audio task.
+* One writer, one reader, no locks: the producer owns head_, the consumer
+* owns tail_, and each publishes its index with release/acquire ordering.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+struct SynthEvent {
+    enum Type : uint8_t { NOTE_ON, NOTE_OFF };
+
+    uint32_t time;      // synth sample clock, see FmDrumSynth::sampleClock()
+    Type     type;
+    uint8_t  note;
+    uint8_t  velocity;
+};
+
+// Size must be a power of two; one slot is kept free, so Size - 1 events fit
+template<typename T, uint32_t Size>
+class SpscQueue {
+    static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    // producer side, false when full
+    bool push(const T& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t next = (head + 1) & (Size - 1);
+        if (next == tail_.load(std::memory_order_acquire)) return false;
+        items_[head] = item;
+        head_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side: look at the oldest item without taking it
+    const T* peek() const {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+        return &items_[tail];
+    }
+
+    // consumer side: drop the item returned by peek()
+    void pop() {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        tail_.store((tail + 1) & (Size - 1), std::memory_order_release);
+    }
+
+    bool empty() const {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+private:
+    T items_[Size];
+    alignas(4) std::atomic<uint32_t> head_{0};
+    alignas(4) std::atomic<uint32_t> tail_{0};
+};
@@ -23,18 +23,25 @@ constexpr int NUM_VOICES = MAX_VOICES;
 
 #include "FmDrumSynth.h"
 #include "DrumkitStorage.h"
+#include "StorageTask.h"
+
+#ifdef TASK_BENCHMARKING
+    #include "VoiceBench.h"
+#endif
 
 constexpr char* TAG = "Main";
    
 
-float DRAM_ATTR outL[DMA_BUFFER_LEN];
-float DRAM_ATTR outR[DMA_BUFFER_LEN];
+// 16-byte aligned for the DspKernels PIE path
+alignas(16) float DRAM_ATTR outL[DMA_BUFFER_LEN];
+alignas(16) float DRAM_ATTR outR[DMA_BUFFER_LEN];
 
-float DRAM_ATTR sendL[DMA_BUFFER_LEN];
-float DRAM_ATTR sendR[DMA_BUFFER_LEN];
+alignas(16) float DRAM_ATTR sendL[DMA_BUFFER_LEN];
+alignas(16) float DRAM_ATTR sendR[DMA_BUFFER_LEN];
 
 FmDrumSynth synth;
 I2S_Audio audio; 
+StorageTask storage;
 
 #include <MIDI.h>
 #if MIDI_IN_DEV == USE_USB_MIDI_DEVICE
@@ -44,6 +51,9 @@ I2S_Audio audio;
 TaskHandle_t audioTaskHandle;
 TaskHandle_t midiTaskHandle;
 TaskHandle_t guiTaskHandle;
+TaskHandle_t voiceTaskHandle;
+TaskHandle_t reverbTaskHandle;
+TaskHandle_t profilerTaskHandle;
 
 #if MIDI_IN_DEV == USE_MIDI_STANDARD
     MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, MIDI);
@@ -81,6 +91,26 @@ static void IRAM_ATTR audioTask(void*) {
     }
 }
 
+#ifdef DUAL_CORE_RENDER
+// -- Voice worker task, core 1: renders the share of voices the audio task posts --
+static void IRAM_ATTR voiceTask(void*) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        synth.runWorker();
+    }
+}
+#endif
+
+#ifdef REVERB_PIPELINE
+// -- Reverb task, core 1: reverberates the send bus of the previous block --
+static void IRAM_ATTR reverbTask(void*) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        synth.runReverbWorker();
+    }
+}
+#endif
+
 // -- MIDI Task --
 static void IRAM_ATTR midiTask(void*) {
     while (true) {
@@ -91,9 +121,23 @@ static void IRAM_ATTR midiTask(void*) {
 #ifdef ENABLE_GUI
         gui.process();
 #endif
+    }
+}
 
+#ifdef TASK_BENCHMARKING
+// -- Profiler dump, core 1 at the storage task's priority: waiting on Serial holds up nothing --
+static void profilerTask(void*) {
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(PROFILER_DUMP_MS));
+        renderProfiler.print([](const char* line) { Serial.print(line); });
+#ifdef SILENCE_THRESHOLD_DB
+        Serial.printf("silence: %u voices ended early, %u of %u reverb blocks skipped\n",
+                      (unsigned)synth.getVoicesRetired(), (unsigned)synth.getReverb().getSkippedBlocks(),
+                      (unsigned)synth.getReverb().getBlocks());
+#endif
     }
 }
+#endif
 
 #ifdef ENABLE_GUI
 // ========================== Core 1 GUI Task ===============================================================================================
@@ -156,13 +200,32 @@ void setup() {
     MIDI.setHandleNoteOn(handleNoteOn);
     MIDI.setHandleNoteOff(handleNoteOff);
     delay(800);
-    
+
+    // checks the PIE kernels against the scalar ones and picks the path
+    DspKernels::init();
+    ESP_LOGI(TAG, "DSP kernels: %s", DspKernels::implName());
+
     synth.init();
 
+#ifdef TASK_BENCHMARKING
+    // cost table of every algorithm/waveform, before the audio task takes the core
+    static VoiceBench::Result benchResult;
+    VoiceBench::run(benchResult, [](const char* line) { Serial.print(line); }, 200, &synth.getReverb());
+#endif
+
 #ifdef ENABLE_GUI
     gui.begin();
     gui.message( "Synth Loading...");
-    bool ok = DrumkitStorage::loadDrumkit(FS_USED, "/drumkits/Drumkit_default.json", synth.getPatchMap(), synth.getReverb());
+    DrumKit& kit = synth.beginKit();
+    uint32_t generation = 0;
+    bool ok = DrumkitStorage::loadDrumkitByName(FS_USED, DRUMKIT_DIR, "Drumkit_default", kit.patches, kit.reverb,
+                                                &generation);
+    if (ok) {
+        synth.commitKit(kit);
+        storage.setKit("Drumkit_default", kit.reverb, generation);
+    } else {
+        synth.refreshSampleCache();     // the built-in map then
+    }
     gui.message(ok ? "Kit Loaded OK" : "Kit Load Failed");
     delay(100);
     ESP_LOGI(TAG, "GUI splash");
@@ -179,6 +242,20 @@ void setup() {
     audio.setMode(I2S_Audio::MODE_OUT);
     audio.init();
 
+#ifdef DUAL_CORE_RENDER
+    // Core 1: voice worker, above MIDI and GUI so the audio task never waits long for it
+    xTaskCreatePinnedToCore(voiceTask, "voices", 8000, nullptr, 7, &voiceTaskHandle, 1);
+    synth.attachWorker([]() { xTaskNotifyGive(voiceTaskHandle); });
+#endif
+
+#ifdef REVERB_PIPELINE
+    // Core 1: reverb, below the voice worker: it has a whole block to finish
+    xTaskCreatePinnedToCore(reverbTask, "reverb", 8000, nullptr, 6, &reverbTaskHandle, 1);
+    synth.attachReverbWorker([]() { xTaskNotifyGive(reverbTaskHandle); });
+#endif
+    ESP_LOGI(TAG, "Reverb %s, wet latency %d samples", synth.isReverbPipelined() ? "pipelined on core 1" : "inline",
+             synth.reverbLatency());
+
     // Core 0: audio
     xTaskCreatePinnedToCore(audioTask, "audio", 8000, nullptr, 8, &audioTaskHandle, 0);
     // Core 1: MIDI + UI
@@ -188,6 +265,16 @@ void setup() {
     xTaskCreatePinnedToCore( gui_task, "GUITask", 8000, NULL, 4, &guiTaskHandle, 1 );
 #endif
 
+    // Core 1: kit files, below everything else so that MIDI never waits for the card
+#ifdef ENABLE_GUI
+    storage.begin(FS_USED, synth, [](const char* text) { gui.postMessage(text); }, 1, 1);
+#else
+    storage.begin(FS_USED, synth, nullptr, 1, 1);
+#endif
+
+#ifdef TASK_BENCHMARKING
+    xTaskCreatePinnedToCore(profilerTask, "profiler", 4096, nullptr, 1, &profilerTaskHandle, 1);
+#endif
 }
 
 void loop() {
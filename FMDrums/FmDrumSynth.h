@@ -3,12 +3,34 @@
 #include "FmVoice6.h"
 #include "DrumVoiceAllocator.h"
 #include "FmPatch.h"
-#include "i2s_in_out.h"
 #include "fx_reverb.h"
+#include "dsp_kernels.h"
+#include "EventQueue.h"
+#include "RenderProfiler.h"
+#include "CoreWorker.h"
+#include "SampleCache.h"
+#include "PatchPool.h"
+#include <atomic>
 
 extern float sendL[DMA_BUFFER_LEN];
 extern float sendR[DMA_BUFFER_LEN];
 
+// one segment of renderVoices() handed to the voice worker
+struct VoiceJob {
+    uint32_t mask;      // voices to render
+    uint32_t rendered;  // renderVoices() bookkeeping, in and out
+    int pos;
+    int len;
+};
+
+// A patch map with its compiled copy and the reverb settings that go with it;
+// the synth has two, see beginKit()
+struct DrumKit {
+    FmDrumPatch* patches = nullptr;     // [128], by MIDI note
+    PatchPool compiled;                 // patches[] compiled for note-on, one per distinct patch
+    ReverbSettings reverb;
+};
+
 class IRAM_ATTR FmDrumSynth {
 public:
     void init() {
@@ -17,110 +39,559 @@ public:
         for (int i = 0; i < MAX_VOICES; ++i)
             voices[i].setSampleRate(SAMPLE_RATE);
 
-        for (int i = 0; i < 128; ++i) {
-            int patchIndex = (i - 36 + numFmDrumPatches) % numFmDrumPatches;
-            patchMap[i] = fmDrumPatches[patchIndex];
+        for (int k = 0; k < 2; ++k) {
+            DrumKit& kit = kits[k];
+            if (!kit.patches) {
+                // only the GUI and the compiler read these, PSRAM will do
+                kit.patches = (FmDrumPatch*) heap_caps_malloc(128 * sizeof(FmDrumPatch), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+                if (!kit.patches) kit.patches = (FmDrumPatch*) heap_caps_malloc(128 * sizeof(FmDrumPatch), MALLOC_CAP_8BIT);
+            }
+            for (int i = 0; i < 128; ++i) {
+                int patchIndex = (i - 36 + numFmDrumPatches) % numFmDrumPatches;
+                kit.patches[i] = fmDrumPatches[patchIndex];
+            }
         }
+        playingKit = &kits[0];
+        editKit.store(playingKit, std::memory_order_release);
+        playingKit->compiled.build(playingKit->patches);   // the sample cache waits for the kit, see commitKit()
         reverb.init();
+        kits[0].reverb = reverb.getSettings();
     }
 
     void applyPatch(uint8_t midiNote, FmDrumPatch& patch) {
-        patchMap[midiNote] = patch;
+        getPatchMap()[midiNote] = patch;
+        patchChanged(midiNote);
+    }
+
+    // getPatchMap() is edited in place by the GUI; whoever changes it must recompile
+    // the cached copy, which is what note-on actually plays. True if the kit's pool
+    // has just run full: have repackKit() run on the loader task then. Waits a block
+    // when the pool's free slots were all let go of in this one (PatchPool::update()).
+    bool patchChanged(uint8_t midiNote) {
+        DrumKit* kit = editKit.load(std::memory_order_acquire);
+        bool repack = false;
+        if (midiNote < 128) {
+            PatchPool::Result r;
+            while ((r = kit->compiled.update(kit->patches, midiNote, blockCount)) == PatchPool::WAIT &&
+                   audioRunning.load(std::memory_order_acquire)) delay(1);
+            if (r != PatchPool::DONE) repack = !repackPending.exchange(true, std::memory_order_acq_rel);
+        }
+        if (midiNote < 128) edited[midiNote >> 5].fetch_or(1u << (midiNote & 31), std::memory_order_release);
+        editCount.fetch_add(1, std::memory_order_release);
+#ifdef SAMPLE_CACHE
+        sampleCache.invalidate(midiNote);   // FM while it is being edited
+#endif
+        return repack;
+    }
+
+    // The notes whose patch changed since the last call, as four 32-bit masks, for
+    // the autosave journal. Taken before the patches are copied: an edit made
+    // while they are being written marks its note again.
+    void takeEditedNotes(uint32_t notes[4]) {
+        for (int i = 0; i < 4; ++i) notes[i] = edited[i].exchange(0, std::memory_order_acquire);
+    }
+
+    void clearEditedNotes() {
+        for (int i = 0; i < 4; ++i) edited[i].store(0, std::memory_order_relaxed);
+    }
+
+    // renders the one-shots edited or loaded since the last call; takes a while,
+    // not for the audio task, and one task at a time (StorageTask on the board)
+    void refreshSampleCache() {
+#ifdef SAMPLE_CACHE
+        sampleCache.refresh(getPatchMap());
+#endif
+    }
+
+    // --- kit switching, loader task ---
+    // A kit is loaded into the idle one of the two DrumKits while the audio task
+    // keeps playing the other: beginKit() hands it out, the loader fills its patches
+    // and reverb settings, commitKit() compiles it and publishes it with one pointer
+    // swap, which the audio task takes at its next block boundary. The reverb then
+    // glides to the new settings over REVERB_FADE_BLOCKS blocks; voices that are
+    // already sounding finish with the patch they started with. Not committing just
+    // drops the loaded data.
+
+    DrumKit& beginKit() {
+        waitKitSwap();      // the idle kit is the one the audio task has let go of
+        DrumKit& kit = kits[editKit.load(std::memory_order_relaxed) == &kits[0] ? 1 : 0];
+        kit.reverb = reverb.getSettings();  // for a kit file without reverb settings
+        return kit;
+    }
+
+    void commitKit(DrumKit& kit) {
+        kit.compiled.build(kit.patches);
+#ifdef SAMPLE_CACHE
+        for (int i = 0; i < 128; ++i) sampleCache.invalidate(i);   // FM until the new kit is cached
+#endif
+        editKit.store(&kit, std::memory_order_release);
+        clearEditedNotes();     // edits of the previous kit, its loader has journaled them
+        publishKit(kit);
+        refreshSampleCache();
+    }
+
+    // An edit found the pool of the kit full (PatchPool::update()): that note plays
+    // its old sound until repackKit() has built the pool afresh. The idle kit takes
+    // over the patch array being edited, so an edit made while the pool is built lands
+    // in the kit that is about to play; the array it had goes to the old kit once the
+    // audio task has let go of that. Editors find the array through getPatchMap() on
+    // every access, as after a kit load. Loader task, like commitKit().
+    inline bool repackWanted() const { return repackPending.load(std::memory_order_acquire); }
+
+    void repackKit() {
+        repackPending.store(false, std::memory_order_relaxed);
+        DrumKit& kit = beginKit();
+        DrumKit* edit = editKit.load(std::memory_order_acquire);
+        FmDrumPatch* spare = kit.patches;
+        kit.patches = edit->patches;        // shared until the swap; no one writes the idle kit
+        kit.reverb = reverb.getSettings();
+        const uint32_t edits = editCount.load(std::memory_order_acquire);
+        kit.compiled.build(kit.patches);
+        editKit.store(&kit, std::memory_order_release);
+        publishKit(kit);
+        edit->patches = spare;
+        // an edit while building may have been compiled half done: once more, then
+        if (editCount.load(std::memory_order_acquire) != edits) repackPending.store(true, std::memory_order_release);
     }
 
 
+    // --- producer side, MIDI/GUI task ---
+    // Events are queued with a timestamp one block ahead of now, then applied by the
+    // audio task at that sample position: constant latency instead of block jitter.
+
     void handleNoteOn(uint8_t midiNote, uint8_t velocity) {
-        auto newPatch = patchMap[midiNote];
-        uint8_t chokeId = newPatch.chokeGroup;
+        queueEvent({ eventTime(), SynthEvent::NOTE_ON, midiNote, velocity });
+    }
+
+    void handleNoteOff(uint8_t midiNote) {
+        queueEvent({ eventTime(), SynthEvent::NOTE_OFF, midiNote, 0 });
+    }
+
+    // ev.time is on the sampleClock() scale; events must be queued in time order
+    bool queueEvent(const SynthEvent& ev) {
+        if (!events.push(ev)) {
+            ESP_LOGW("Synth", "Event queue full, note %d dropped", ev.note);
+            return false;
+        }
+        return true;
+    }
+
+    // sample clock at the start of the block being rendered now
+    uint32_t sampleClock() const {
+        uint32_t clock, us;
+        readClock(clock, us);
+        return clock;
+    }
+
+private:
+    // now, as a sample clock value one block ahead; a late producer never gets more
+    // than one extra block of latency
+    uint32_t eventTime() const {
+        uint32_t clock, us;
+        readClock(clock, us);
+        uint32_t elapsed = (uint32_t)(((uint64_t)(micros() - us) * SAMPLE_RATE) / 1000000ULL);
+        if (elapsed >= DMA_BUFFER_LEN) elapsed = DMA_BUFFER_LEN - 1;
+        return clock + DMA_BUFFER_LEN + elapsed;
+    }
+
+    // seqlock: the audio task is the only writer
+    void writeClock(uint32_t clock, uint32_t us) {
+        uint32_t seq = clockSeq.load(std::memory_order_relaxed);
+        clockSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        clockSamples.store(clock, std::memory_order_relaxed);
+        clockUs.store(us, std::memory_order_relaxed);
+        clockSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    void readClock(uint32_t& clock, uint32_t& us) const {
+        uint32_t seq;
+        do {
+            seq = clockSeq.load(std::memory_order_acquire);
+            clock = clockSamples.load(std::memory_order_relaxed);
+            us = clockUs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != clockSeq.load(std::memory_order_relaxed));
+    }
+
+    // --- consumer side, audio task ---
+
+    void applyEvent(const SynthEvent& ev) {
+        if (ev.type == SynthEvent::NOTE_ON) noteOnNow(ev.note, ev.velocity);
+        else                                noteOffNow(ev.note);
+    }
+
+    void noteOnNow(uint8_t midiNote, uint8_t velocity) {
+        const FmVoicePatch* pooled = playingKit->compiled.forNote(midiNote);
+        if (!pooled) return;        // the pool got no memory for its kit, see PatchPool::build()
+        const FmVoicePatch& patch = *pooled;
+        uint8_t chokeId = patch.chokeGroup;
         int idx = allocator.allocateVoice(midiNote, chokeId);
         if (idx < 0 || idx >= MAX_VOICES) {
             ESP_LOGE("Synth", "Invalid voice %d", idx);
             return;
         }
         voices[idx].reset();
-        voices[idx].applyPatch(newPatch);
-        voices[idx].noteOn(-1.0f, midiNote, velocity * MIDI_NORM);
-        ESP_LOGI("Synth", "Note %d on, voice %d", midiNote, idx);
+        voices[idx].applyCompiled(patch);
+#ifdef SAMPLE_CACHE
+        voices[idx].playCached(sampleCache.forNote(midiNote), patch);
+#endif
+        voices[idx].noteOn(midiNote, velocity * MIDI_NORM);
+        allocator.voiceStarted(idx);
+        ESP_LOGD("Synth", "Note %d on, voice %d", midiNote, idx);
     }
 
+    void noteOffNow(uint8_t midiNote) {
+        int n = allocator.releaseNote(midiNote);
+        if (n > 0) ESP_LOGD("Synth", "Note %d off, %d voice(s)", midiNote, n);
+    }
 
-    void handleNoteOff(uint8_t midiNote) {
-        int idx = allocator.getActiveVoiceForNote(midiNote) ;
-        if (idx >= 0) {
-            voices[idx].noteOff();
-            allocator.releaseNote(midiNote);
-            ESP_LOGI("Synth", "Note %d off, voice %d", midiNote, idx);
-        }        
-    }
-    
+    // Renders the voices into their block buffers, split at every queued event due in
+    // this block, so each event lands on its own sample and voices are never changed
+    // in the middle of process(). Only the allocator's live voices are visited, plus
+    // those already rendered in this block that an allocation has dropped meanwhile.
+    void renderVoices() {
+        uint32_t rendered = 0;  // voices that have output somewhere in this block
+        int pos = 0;
+        while (pos < DMA_BUFFER_LEN) {
+            int next = DMA_BUFFER_LEN;
+            while (const SynthEvent* ev = events.peek()) {
+                int32_t offset = (int32_t)(ev->time - blockClock);
+                if (offset > pos) {
+                    if (offset < next) next = offset;
+                    break;
+                }
+                applyEvent(*ev);   // late events are applied right away
+                events.pop();
+            }
+
+            const uint32_t mask = allocator.activeMask() | rendered;
+            const uint32_t workerMask = voiceWorker.attached() ? partition(mask) : 0;
+            if (workerMask) {
+                // the worker's voices on core 1, ours meanwhile, then the barrier
+                voiceWorker.post({ workerMask, rendered, pos, next - pos });
+                rendered = renderSegment({ mask & ~workerMask, rendered, pos, next - pos });
+                rendered = (rendered & ~workerMask) | (voiceWorker.join() & workerMask);
+            } else {
+                rendered = renderSegment({ mask, rendered, pos, next - pos });
+            }
+            pos = next;
+        }
+        renderedVoices = rendered;
+#ifdef SILENCE_THRESHOLD_DB
+        retireSilentVoices(rendered);
+#endif
+        allocator.updateActive();
+    }
+
+#ifdef SILENCE_THRESHOLD_DB
+    // A decaying voice whose block peak has stayed below SILENCE_THRESHOLD_DB for
+    // SILENCE_HOLD_BLOCKS blocks is ended here instead of running its envelope down
+    // to the last bit. Its buffer still goes into this block's mix.
+    void retireSilentVoices(uint32_t rendered) {
+        static const float silenceLevel = powf(10.0f, SILENCE_THRESHOLD_DB * 0.05f);
+        for (uint32_t m = rendered; m; m &= m - 1) {
+            const int v = __builtin_ctz(m);
+            if (!voices[v].isActive()) continue;
+            if (voices[v].trackSilence(DspKernels::peak(voices[v].getBlockBuffer(), DMA_BUFFER_LEN) < silenceLevel)) {
+                voices[v].retire();
+                ++voicesRetired;
+            }
+        }
+    }
+#endif
+
+    // Renders [pos, pos + len) of the voices in job.mask; voices are independent of
+    // each other, so the two cores can each run this on their own share.
+    uint32_t renderSegment(const VoiceJob& job) {
+        uint32_t rendered = job.rendered;
+        for (uint32_t m = job.mask; m; m &= m - 1) {
+            const int v = __builtin_ctz(m);
+            float* buf = voices[v].getBlockBuffer();
+            if (likely(voices[v].isActive())) {
+                if (!(rendered & (1u << v))) {
+                    memset(buf, 0, job.pos * sizeof(float));
+                    rendered |= (1u << v);
+                }
+                voices[v].process(job.pos, job.len);
+            } else if (rendered & (1u << v)) {
+                memset(buf + job.pos, 0, job.len * sizeof(float));
+            }
+        }
+        return rendered;
+    }
+
+    // FxReverb::processBlock() in FmVoice6 render cost units, as VoiceBench prints it;
+    // from the host build, which gives 26 to 46 from run to run
+    static constexpr int ReverbRenderCost = 36;
+
+    // Picks the worker's share of the running voices in mask: heaviest first, each onto
+    // the core with less work so far, so the six-operator algorithms get spread out.
+    // The pipelined reverb runs on the worker's core too and counts as work there
+    // from the start. Returns 0 (all on this core) when there is nothing to split.
+    uint32_t partition(uint32_t mask) {
+        int order[MAX_VOICES];
+        uint8_t cost[MAX_VOICES];
+        int n = 0;
+        for (uint32_t m = mask; m; m &= m - 1) {
+            const int v = __builtin_ctz(m);
+            if (!voices[v].isActive()) continue;
+            const uint8_t c = voices[v].getRenderCost();
+            int i = n++;
+            for (; i > 0 && cost[i - 1] < c; --i) {
+                order[i] = order[i - 1];
+                cost[i] = cost[i - 1];
+            }
+            order[i] = v;
+            cost[i] = c;
+        }
+        if (n < 2) return 0;
+
+        uint32_t workerMask = 0;
+        int load = 0, workerLoad = isReverbPipelined() ? ReverbRenderCost : 0;
+        for (int i = 0; i < n; ++i) {
+            if (workerLoad < load) {
+                workerMask |= 1u << order[i];
+                workerLoad += cost[i];
+            } else {
+                load += cost[i];
+            }
+        }
+        return workerMask;
+    }
+
+    // hands a committed kit to the audio task, at its next block boundary if it runs
+    void publishKit(DrumKit& kit) {
+        if (audioRunning.load(std::memory_order_acquire)) {
+            reverb.setFadeSettings(kit.reverb);
+            pendingKit.store(&kit, std::memory_order_release);
+            waitKitSwap();
+        } else {
+            playingKit = &kit;
+            reverb.setSettings(kit.reverb);
+        }
+    }
+
+    // until the audio task has taken the last committed kit
+    void waitKitSwap() const {
+        while (pendingKit.load(std::memory_order_acquire)) delay(1);
+    }
+
+    // a kit committed since the last block: play it from here on
+    void takePendingKit() {
+        DrumKit* kit = pendingKit.load(std::memory_order_acquire);
+        if (!kit) return;
+        playingKit = kit;
+        reverbFade = kit->reverb;
+        reverbFadePending = true;
+        reverbFadeBlocks = REVERB_FADE_BLOCKS;
+        pendingKit.store(nullptr, std::memory_order_release);
+    }
+
+    // settings posted by setReverbSettings() since the last block; while the GUI task
+    // is writing them they wait for the next block, the audio task never spins
+    void takeReverbEdit() {
+        const uint32_t seq = reverbSeq.load(std::memory_order_acquire);
+        if ((seq & 1) || seq == reverbSeqTaken) return;
+        ReverbSettings s;
+        s.time = reverbEdit[0].load(std::memory_order_relaxed);
+        s.level = reverbEdit[1].load(std::memory_order_relaxed);
+        s.damping = reverbEdit[2].load(std::memory_order_relaxed);
+        s.preDelayMs = reverbEdit[3].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq != reverbSeq.load(std::memory_order_relaxed)) return;
+        reverbSeqTaken = seq;
+        reverbFade = s;
+        reverbFadeBlocks = REVERB_EDIT_BLOCKS;
+        reverbFadePending = true;
+    }
+
+    // the reverb is between blocks here, also when it runs pipelined on the other core
+    void startReverbFade() {
+        if (!reverbFadePending) return;
+        reverb.fadeTo(reverbFade, reverbFadeBlocks);
+        reverbFadePending = false;
+    }
+
+public:
     void renderAudioBlock(float* outL, float* outR) {
- 
+        audioRunning.store(true, std::memory_order_release);
+        takeReverbEdit();
+        takePendingKit();       // a kit loaded in the same block wins over the edit
+        blockCount.store(blockCount.load(std::memory_order_relaxed) + 1);     // before this block's note-ons
+        writeClock(blockClock, micros());
         memset(outL, 0, DMA_BUFFER_LEN * sizeof(float));
         memset(outR, 0, DMA_BUFFER_LEN * sizeof(float));
 
         memset(sendL, 0, DMA_BUFFER_LEN * sizeof(float));
         memset(sendR, 0, DMA_BUFFER_LEN * sizeof(float));
 
-        t1 = micros();
+        renderVoices();
 
-        for (int v = 0; v < MAX_VOICES; ++v) {
-            if (likely(voices[v].isActive())) {
-                voices[v].process(); // write into internal buffer
-            }
+        PROFILE_STAGE(VOICES);
+
+        // voice by voice in ascending order, so the sums are unchanged
+        for (uint32_t m = renderedVoices; m; m &= m - 1) {
+            const int v = __builtin_ctz(m);
+            DspKernels::mixVoice(outL, outR, sendL, sendR, voices[v].getBlockBuffer(),
+                                 0.25f, voices[v].getPanL(), voices[v].getPanR(), voices[v].getReverbSend(),
+                                 DMA_BUFFER_LEN);
         }
 
-        t2 = micros();
+        PROFILE_STAGE(MIX);
 
-        for (int i = 0; i < DMA_BUFFER_LEN; ++i) {
-            float mixL = 0.f;
-            float mixR = 0.f;
+        runReverb(outL, outR);
 
-            for (int v = 0; v < MAX_VOICES; ++v) {
-                if (likely(voices[v].isActive())) {
-                    float s = 0.25f * voices[v].getBlockBuffer()[i];
-                    mixL += s * voices[v].getPanL();
-                    mixR += s * voices[v].getPanR();
+        blockClock += DMA_BUFFER_LEN;
 
-                    float sendAmt = voices[v].getReverbSend();
-                    sendL[i] += s * sendAmt;
-                    sendR[i] += s * sendAmt;
-                }
-            }
+        PROFILE_STAGE(REVERB);
+    }
 
-            outL[i] = mixL;
-            outR[i] = mixR;
+    // --- dual-core rendering ---
+    // attachWorker() with a function that wakes a task on the other core, which then
+    // calls runWorker(); from then on each block's voices are split between the cores.
+    // Call it before the audio task starts.
 
-        }
+    void attachWorker(CoreWorker<VoiceJob>::KickFn kick) { voiceWorker.attach(kick); }
 
-        t3 = micros();
+    bool runWorker() {
+        return voiceWorker.run([this](const VoiceJob& job) { return renderSegment(job); });
+    }
 
-        reverb.processBlock(sendL, sendR);
+    // --- pipelined reverb ---
+    // Same scheme for the reverb: attachReverbWorker() wakes a task on the other core
+    // that calls runReverbWorker(). While pipelined, block N's send bus is reverberated
+    // there during block N+1 and its wet output is heard one block late.
 
-        t4 = micros();
+#ifdef REVERB_PIPELINE
+    void attachReverbWorker(CoreWorker<int>::KickFn kick) { reverbWorker.attach(kick); }
 
-        for (int i = 0; i < DMA_BUFFER_LEN; ++i) {
-            outL[i] += sendL[i];
-            outR[i] += sendR[i];
+    bool runReverbWorker() {
+        return reverbWorker.run([this](const int& slot) -> uint32_t {
+            reverb.processBlock(pipeL[slot], pipeR[slot]);
+            return 0;
+        });
+    }
+
+    // any task; switches at the next block
+    void setReverbPipelined(bool on) { pipelineRequested.store(on, std::memory_order_relaxed); }
+
+    bool isReverbPipelined() const {
+        return pipelineRequested.load(std::memory_order_relaxed) && reverbWorker.attached();
+    }
+#else
+    bool isReverbPipelined() const { return false; }
+#endif
+
+    // delay of the reverb's wet signal against the dry one, in samples
+    int reverbLatency() const { return isReverbPipelined() ? DMA_BUFFER_LEN : 0; }
+
+private:
+    void runReverb(float* outL, float* outR) {
+#ifdef REVERB_PIPELINE
+        const bool wanted = isReverbPipelined();
+        if (wanted || pipelined) {
+            reverbWorker.join();            // the previous block's wet is ready
+            startReverbFade();
+            const int prev = pipeSlot ^ 1;
+            if (wanted) {
+                if (!pipelined) {           // just switched on, nothing in flight
+                    memset(pipeL[prev], 0, DMA_BUFFER_LEN * sizeof(float));
+                    memset(pipeR[prev], 0, DMA_BUFFER_LEN * sizeof(float));
+                }
+                memcpy(pipeL[pipeSlot], sendL, DMA_BUFFER_LEN * sizeof(float));
+                memcpy(pipeR[pipeSlot], sendR, DMA_BUFFER_LEN * sizeof(float));
+                reverbWorker.post(pipeSlot);
+                DspKernels::add(outL, pipeL[prev], DMA_BUFFER_LEN);
+                DspKernels::add(outR, pipeR[prev], DMA_BUFFER_LEN);
+                pipeSlot = prev;
+                pipelined = true;
+                return;
+            }
+            // switched off: the last wet block still goes out, then inline again
+            DspKernels::add(outL, pipeL[prev], DMA_BUFFER_LEN);
+            DspKernels::add(outR, pipeR[prev], DMA_BUFFER_LEN);
+            pipelined = false;
         }
+#endif
+        startReverbFade();
+        reverb.processBlock(sendL, sendR);
 
-        
-  //      if (decimator++ >= 1024) {
-  //          decimator = 0;
-  //          ESP_LOGI("Synth", "Render times: voice %d, pan-n-mix %d, reverb %d", t2-t1, t3-t2, t4-t3);
-  //      }
+        DspKernels::add(outL, sendL, DMA_BUFFER_LEN);
+        DspKernels::add(outR, sendR, DMA_BUFFER_LEN);
     }
 
+public:
     // Accessors
-    FmDrumPatch* getPatchMap() { return patchMap; }
+    FmDrumPatch* getPatchMap() { return editKit.load(std::memory_order_acquire)->patches; }   // the last committed kit
     FmVoice6* getVoices() { return voices; }
     DrumVoiceAllocator& getAllocator() { return allocator; }
     inline FxReverb& getReverb() { return reverb; }
 
+    // --- reverb edits, GUI task ---
+    // The menu leaves the FxReverb the audio task runs alone: setReverbSettings() posts
+    // the settings through a seqlock, and the audio task glides to them over
+    // REVERB_EDIT_BLOCKS from its next block on, the way it does to a loaded kit's.
+    // getReverb().getSettings() reports them from the call on.
+    void setReverbSettings(const ReverbSettings& s) {
+        reverb.setFadeSettings(s);
+        if (!audioRunning.load(std::memory_order_acquire)) {
+            reverb.setSettings(s);
+            return;
+        }
+        // seqlock: the GUI task is the only writer
+        uint32_t seq = reverbSeq.load(std::memory_order_relaxed);
+        reverbSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        reverbEdit[0].store(s.time, std::memory_order_relaxed);
+        reverbEdit[1].store(s.level, std::memory_order_relaxed);
+        reverbEdit[2].store(s.damping, std::memory_order_relaxed);
+        reverbEdit[3].store(s.preDelayMs, std::memory_order_relaxed);
+        reverbSeq.store(seq + 2, std::memory_order_release);
+    }
+
+#ifdef SAMPLE_CACHE
+    inline SampleCache& getSampleCache() { return sampleCache; }
+#endif
+    inline uint32_t getVoicesRetired() const { return voicesRetired; }  // ended early by silence detection
+
 private:
     FmVoice6 voices[MAX_VOICES];
     DrumVoiceAllocator allocator;
-    FmDrumPatch patchMap[128];
+    DrumKit kits[2];
+    std::atomic<DrumKit*> editKit{nullptr}; // the last committed kit, for the GUI; one loader task at a time
+    DrumKit* playingKit = nullptr;          // audio task: the kit note-on plays
+    std::atomic<DrumKit*> pendingKit{nullptr};  // committed, not taken by the audio task yet
+    std::atomic<bool> audioRunning{false};
+    std::atomic<uint32_t> edited[4] = {};  // patchChanged() since takeEditedNotes()
+    std::atomic<uint32_t> editCount{0};     // patchChanged() calls, see repackKit()
+    std::atomic<bool> repackPending{false};
+    std::atomic<uint32_t> blockCount{0};    // blocks started, written by the audio task only; see PatchPool::update()
+    ReverbSettings reverbFade;              // audio task only, see startReverbFade()
+    int reverbFadeBlocks = REVERB_FADE_BLOCKS;  // audio task only
+    bool reverbFadePending = false;
+    std::atomic<uint32_t> reverbSeq{0};     // see setReverbSettings()
+    std::atomic<float> reverbEdit[4] = {};  // time, level, damping, pre-delay ms
+    uint32_t reverbSeqTaken = 0;            // audio task only
     FxReverb reverb;
-    uint32_t decimator = 0;
-    size_t  t1 = 0, t2 = 0, t3 = 0, t4 = 0; 
+#ifdef SAMPLE_CACHE
+    SampleCache sampleCache;
+#endif
+
+    SpscQueue<SynthEvent, EVENT_QUEUE_SIZE> events;
+    CoreWorker<VoiceJob> voiceWorker;
+#ifdef REVERB_PIPELINE
+    CoreWorker<int> reverbWorker;           // job: the pipe slot to reverberate
+    alignas(16) float pipeL[2][DMA_BUFFER_LEN] = {};
+    alignas(16) float pipeR[2][DMA_BUFFER_LEN] = {};
+    int pipeSlot = 0;                       // audio task only
+    bool pipelined = false;                 // audio task only: mode of the last block
+    std::atomic<bool> pipelineRequested{true};
+#endif
+    uint32_t blockClock = 0;      // audio task only
+    uint32_t renderedVoices = 0;  // audio task only
+    uint32_t voicesRetired = 0;   // audio task only
+    std::atomic<uint32_t> clockSeq{0};
+    std::atomic<uint32_t> clockSamples{0};
+    std::atomic<uint32_t> clockUs{0};
 };
@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include <vector>
 #include "misc.h"
+#include "FmOperatorBank.h"
 
 #define MOD_RANGE 16.0f
 
@@ -56,6 +57,13 @@ public:
     Enum value;
 };
 
+// Rendering class of a waveform, used to specialise voice renderers at compile time.
+// Sine covers sin, cos and their negatives: all of them are sign * sin(t + offset).
+enum class WaveClass : uint8_t { Sine, Any };
+
+// What an operator's output is used for: phase modulation, amplitude modulation or audio
+enum class OpMode : uint8_t { Fm, Am, Out };
+
 // === Waveform generators ===
 inline float __attribute__((always_inline)) IRAM_ATTR wf_sine(float t)     { return SIN_FUNC_NORM(t); }
 inline float __attribute__((always_inline)) IRAM_ATTR wf_cos(float t)      { return SIN_FUNC_NORM(t + 0.25f); }
@@ -70,9 +78,59 @@ inline float __attribute__((always_inline)) IRAM_ATTR wf_negsaw(float t)      {
 
 class IRAM_ATTR FmOperator {
 public:
-    FmOperator() {
+    // bankIndex is the operator's slot in fmOperatorBank, see FmOperatorBank::index()
+    explicit FmOperator(int bankIndex = 0) : idx_(bankIndex) {
         setWaveform(Waveform::Sine);
         setVolume(0.8f);
+        setFeedback(0.0f);
+        updatePhaseInc();
+        reset();
+    }
+
+    // Everything the setters below derive from one operator's patch values,
+    // precomputed by makeParams() so that setParams() needs no powf()
+    struct Params {
+        float baseFreq, ratio, detune, fb, feedback, volume;
+        Waveform waveform;
+        uint32_t phaseInc, sineOffset;
+        float fmLevel, outLevel, amLevel, amOffset, sineSign;
+    };
+
+    static Params makeParams(float baseFreq, float ratio, float detune, float fb, float volume, Waveform wf) {
+        Params p;
+        p.baseFreq = baseFreq;
+        p.ratio = ratio;
+        p.detune = detune;
+        p.fb = fb;
+        p.feedback = feedbackCoeff(fb);
+        p.volume = volume;
+        p.waveform = wf;
+        p.phaseInc = phaseIncFor(baseFreq, ratio, detune);
+        p.outLevel = volume;
+        p.fmLevel = fmLevelFor(volume);
+        p.amLevel = volume * 0.5f;
+        p.amOffset = 1.0f - p.amLevel;
+        sineShape(wf, p.sineSign, p.sineOffset);
+        return p;
+    }
+
+    void setParams(const Params& p) {
+        baseFreq_ = p.baseFreq;
+        ratio_ = p.ratio;
+        detune_ = p.detune;
+        fb_ = p.fb;
+        feedback_ = p.feedback;
+        volume_ = p.volume;
+        waveform_ = p.waveform;
+        FmOperatorBank& b = fmOperatorBank;
+        b.phaseInc[idx_] = p.phaseInc;
+        b.fbMult[idx_] = fbMod_ * feedback_;
+        b.fmLevel[idx_] = p.fmLevel;
+        b.outLevel[idx_] = p.outLevel;
+        b.amLevel[idx_] = p.amLevel;
+        b.amOffset[idx_] = p.amOffset;
+        b.sineSign[idx_] = p.sineSign;
+        b.sineOffset[idx_] = p.sineOffset;
     }
 
     inline float& getSampleRate()   { return sampleRate_; }
@@ -115,30 +173,47 @@ public:
 
     void setFeedback(float f) {
         fb_ = f;
-        feedback_ = (fb_ == 0) ? 0.0f : (1.0f / powf(2.0f, (7.0f - fb_)));
-        fbMult_ = fbMod_ * feedback_;
+        feedback_ = feedbackCoeff(fb_);
+        fbMult() = fbMod_ * feedback_;
     }
 
     void setFeedbackMod(float m) {
         fbMod_ = m;
-        fbMult_ = fbMod_ * feedback_;
+        fbMult() = fbMod_ * feedback_;
     }
 
     void setWaveform(Waveform wf = Waveform::Sine) {
         waveform_ = wf;
+        sineShape(wf, fmOperatorBank.sineSign[idx_], fmOperatorBank.sineOffset[idx_]);
+    }
+
+    inline bool isSineClass() const { return isSineClass(waveform_); }
+
+    static inline bool isSineClass(Waveform wf) {
+        switch (wf.value) {
+            case Waveform::Sine: case Waveform::Cosine:
+            case Waveform::NegSine: case Waveform::NegCosine:
+                return true;
+            default:
+                return false;
+        }
     }
 
     void setVolume(float v) {
         volume_ = v;
-        outLevel_ = volume_;
-        fmLevel_  = 0.1f * powf(161.0f, volume_) - 0.1f;
-        amLevel_  = volume_ * 0.5f;
-        amOffset_  = 1.0f - amLevel_;
+        FmOperatorBank& b = fmOperatorBank;
+        b.outLevel[idx_] = volume_;
+        b.fmLevel[idx_]  = fmLevelFor(volume_);
+        b.amLevel[idx_]  = volume_ * 0.5f;
+        b.amOffset[idx_] = 1.0f - b.amLevel[idx_];
     }
 
     void reset() {
-        phase_ = 0.f;
-        lastOut_ = 0.f;
+        fmOperatorBank.phase[idx_] = 0;
+        fmOperatorBank.lastOut[idx_] = 0.f;
+#ifdef FIXED_POINT_ENGINE
+        fmOperatorBank.lastOutQ[idx_] = 0;
+#endif
     }
 
     inline float __attribute__((always_inline)) IRAM_ATTR     renderWaveform(Waveform::Enum wf, float t) {
@@ -157,46 +232,222 @@ public:
         }
     }
 
+    // W == WaveClass::Sine must only be used when isSineClass() is true
+    template<WaveClass W>
+    inline float __attribute__((always_inline)) IRAM_ATTR render(uint32_t t) {
+        if constexpr (W == WaveClass::Sine) {
+            return fmOperatorBank.sineSign[idx_] * SIN_FUNC_PHASE(t + fmOperatorBank.sineOffset[idx_]);
+        } else {
+            return renderWaveform(waveform_.value, phaseToUnit(t));
+        }
+    }
+
+    template<WaveClass W = WaveClass::Any>
     inline float __attribute__((always_inline)) IRAM_ATTR fmProcess(float modIn, float env) {
-        float t = advance(modIn);
-        float s = renderWaveform(waveform_.value, t);
-        lastOut_ = s;
-        return fmLevel_ * s * env;
+        uint32_t t = advance(modIn);
+        float s = render<W>(t);
+        fmOperatorBank.lastOut[idx_] = s;
+        return fmOperatorBank.fmLevel[idx_] * s * env;
     }
 
+    template<WaveClass W = WaveClass::Any>
     inline float __attribute__((always_inline)) IRAM_ATTR amProcess(float modIn) {
-        float t = advance(modIn);
-        float s = renderWaveform(waveform_.value, t);
-        lastOut_ = s;
-        return amOffset_ + amLevel_ * s; 
+        uint32_t t = advance(modIn);
+        float s = render<W>(t);
+        fmOperatorBank.lastOut[idx_] = s;
+        return fmOperatorBank.amOffset[idx_] + fmOperatorBank.amLevel[idx_] * s;
     }
 
+    template<WaveClass W = WaveClass::Any>
     inline float __attribute__((always_inline)) IRAM_ATTR outProcess(float modIn, float env) {
-        float t = advance(modIn);
-        float s = renderWaveform(waveform_.value, t);
-        lastOut_ = s;
-        return outLevel_ * s * env;
+        uint32_t t = advance(modIn);
+        float s = render<W>(t);
+        fmOperatorBank.lastOut[idx_] = s;
+        return fmOperatorBank.outLevel[idx_] * s * env;
     }
 
+    // Block version of fm/am/outProcess(): renders n samples into out, or adds them to out when Acc.
+    // modIn may be nullptr for an unmodulated operator and may be the same buffer as out.
+    // env is not used in Am mode.
+    template<OpMode M, WaveClass W, bool Acc = false>
+    inline void __attribute__((always_inline)) IRAM_ATTR processBlock(const float* modIn, const float* env, float* out, int n) {
+        // without feedback there is no sample-to-sample dependency, so that loop pipelines much better
+        const bool fb = (fbMult() != 0.0f);
+        if (modIn) {
+            if (fb) blockLoop<M, W, Acc, true, true>(modIn, env, out, n);
+            else    blockLoop<M, W, Acc, true, false>(modIn, env, out, n);
+        } else {
+            if (fb) blockLoop<M, W, Acc, false, true>(modIn, env, out, n);
+            else    blockLoop<M, W, Acc, false, false>(modIn, env, out, n);
+        }
+    }
+
+#ifdef FIXED_POINT_ENGINE
+    // Integer version of the above, see FIXED_POINT_ENGINE in config.h. The waveforms
+    // run in Q30 off a 32-bit phase; the buffers hold:
+    //   env            Q31, 0..1
+    //   Fm output      phase offset, 2^32 = one turn (MOD_RANGE already applied); adds up wrapping
+    //   Am output      Q31, 0..1
+    //   Out output     Q24 audio
+    template<OpMode M, WaveClass W, bool Acc = false>
+    inline void __attribute__((always_inline)) IRAM_ATTR processBlock(const int32_t* modIn, const int32_t* env, int32_t* out, int n) {
+        const bool fb = (fbMult() != 0.0f);
+        if (modIn) {
+            if (fb) blockLoopQ<M, W, Acc, true, true>(modIn, env, out, n);
+            else    blockLoopQ<M, W, Acc, true, false>(modIn, env, out, n);
+        } else {
+            if (fb) blockLoopQ<M, W, Acc, false, true>(modIn, env, out, n);
+            else    blockLoopQ<M, W, Acc, false, false>(modIn, env, out, n);
+        }
+    }
+#endif
 
 private:
-    inline float __attribute__((always_inline)) IRAM_ATTR wrap01(float x) const {
-        return x - fast_floorf(x);
+#ifdef FIXED_POINT_ENGINE
+    template<OpMode M, WaveClass W, bool Acc, bool Mod, bool Fb>
+    inline void __attribute__((always_inline)) IRAM_ATTR blockLoopQ(const int32_t* modIn, const int32_t* env, int32_t* out, int n) {
+        // the coefficients come from the float bank values, once per block
+        FmOperatorBank& b = fmOperatorBank;
+        const int k = idx_;
+        uint32_t phase = b.phase[k];
+        int32_t last = b.lastOutQ[k];
+        const uint32_t inc = b.phaseInc[k];
+        const int64_t fb = (int64_t)(b.fbMult[k] * 1073741824.0f);                            // Q30
+        const int64_t fmGain = (int64_t)(b.fmLevel[k] * (MOD_RANGE * 4.0f * 65536.0f));       // Q30 amp -> phase, Q16
+        const int64_t outLevel = (int64_t)(b.outLevel[k] * 1073741824.0f);                    // Q30
+        const int64_t amLevel = (int64_t)(b.amLevel[k] * 2147483648.0f);                      // Q31
+        const int32_t amOffset = INT32_MAX - (int32_t)amLevel;                                // keeps the peak below 1.0
+        const uint32_t sineOffset = b.sineOffset[k];
+        const int32_t sineNeg = (b.sineSign[k] < 0.0f) ? -1 : 0;
+        const Waveform::Enum wf = waveform_.value;
+        for (int i = 0; i < n; ++i) {
+            phase += inc;
+            uint32_t x = phase;
+            if (Mod) x += (uint32_t)modIn[i];
+            if (Fb)  x += (uint32_t)((last * fb) >> 28);
+            int32_t s;                                                                          // Q30
+            if (W == WaveClass::Sine) s = (sin_q30(x + sineOffset) ^ sineNeg) - sineNeg;
+            else                      s = renderWaveformQ(wf, x);
+            last = s;
+            int32_t y;
+            if (M == OpMode::Am) {
+                y = amOffset + (int32_t)((s * amLevel) >> 30);
+            } else {
+                const int64_t amp = ((int64_t)s * env[i]) >> 31;                                 // Q30
+                if (M == OpMode::Fm) y = (int32_t)(uint32_t)((amp * fmGain) >> 16);
+                else                 y = (int32_t)((amp * outLevel) >> 36);
+            }
+            if (Acc) out[i] = (int32_t)((uint32_t)out[i] + (uint32_t)y);
+            else     out[i] = y;
+        }
+        b.phase[k] = phase;
+        b.lastOutQ[k] = last;
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR advance(float modIn) {
-        phase_ += phaseInc_;
-        if (phase_ >= 1.0f) phase_ -= 1.0f;
-        return wrap01(phase_ + modIn * MOD_RANGE + fbMult_ * lastOut_);
+    // Q30 waveforms of a 32-bit phase
+    static inline int32_t __attribute__((always_inline)) IRAM_ATTR renderWaveformQ(Waveform::Enum wf, uint32_t t) {
+        const int32_t tri = (int32_t)(((t >= 0x80000000u) ? t - 0x80000000u : 0x80000000u - t) - 0x40000000u);
+        const int32_t saw = (int32_t)(t >> 1) - 0x40000000;
+        const int32_t sqr = (t < 0x80000000u) ? 0x40000000 : -0x40000000;
+        switch (wf) {
+            case Waveform::Sine:        return sin_q30(t);
+            case Waveform::Cosine:      return sin_q30(t + 0x40000000u);
+            case Waveform::Triangle:    return tri;
+            case Waveform::Square:      return sqr;
+            case Waveform::Saw:         return saw;
+            case Waveform::NegSine:     return -sin_q30(t);
+            case Waveform::NegCosine:   return -sin_q30(t + 0x40000000u);
+            case Waveform::NegTriangle: return -tri;
+            case Waveform::NegSquare:   return -sqr;
+            case Waveform::NegSaw:      return -saw;
+            default:                    return sin_q30(t);
+        }
+    }
+#endif
+
+    template<OpMode M, WaveClass W, bool Acc, bool Mod, bool Fb>
+    inline void __attribute__((always_inline)) IRAM_ATTR blockLoop(const float* modIn, const float* env, float* out, int n) {
+        // keep the running state in registers for the whole block
+        FmOperatorBank& b = fmOperatorBank;
+        const int k = idx_;
+        uint32_t phase = b.phase[k];
+        float last = b.lastOut[k];
+        const uint32_t inc = b.phaseInc[k];
+        const float fb = b.fbMult[k];
+        const float level = (M == OpMode::Fm) ? b.fmLevel[k] : (M == OpMode::Out) ? b.outLevel[k] : b.amLevel[k];
+        const float amOffset = b.amOffset[k];
+        const float sineSign = b.sineSign[k];
+        const uint32_t sineOffset = b.sineOffset[k];
+        const Waveform::Enum wf = waveform_.value;
+        for (int i = 0; i < n; ++i) {
+            phase += inc;
+            uint32_t t = phase;
+            if (Mod || Fb) {
+                float m = 0.0f;
+                if (Mod) m = modIn[i] * MOD_RANGE;
+                if (Fb)  m += fb * last;
+                t += toPhase(m);
+            }
+            float s = (W == WaveClass::Sine) ? sineSign * SIN_FUNC_PHASE(t + sineOffset) : renderWaveform(wf, phaseToUnit(t));
+            last = s;
+            float y = (M == OpMode::Am) ? (amOffset + level * s) : (level * s * env[i]);
+            if (Acc) out[i] += y;
+            else     out[i] = y;
+        }
+        b.phase[k] = phase;
+        b.lastOut[k] = last;
+    }
+
+    // phase offset of a modulation given in turns; |turns| < 1024, resolution 2^-21 turn
+    static inline uint32_t __attribute__((always_inline)) IRAM_ATTR toPhase(float turns) {
+        return (uint32_t)(int32_t)(turns * 2097152.0f) << 11;
     }
 
+    // 32-bit phase -> [0, 1) for the float waveforms
+    static inline float __attribute__((always_inline)) IRAM_ATTR phaseToUnit(uint32_t t) {
+        return (float)(t >> 8) * (1.0f / 16777216.0f);
+    }
+
+    inline uint32_t __attribute__((always_inline)) IRAM_ATTR advance(float modIn) {
+        FmOperatorBank& b = fmOperatorBank;
+        uint32_t& phase = b.phase[idx_];
+        phase += b.phaseInc[idx_];
+        return phase + toPhase(modIn * MOD_RANGE + b.fbMult[idx_] * b.lastOut[idx_]);
+    }
+
+
+    inline float& fbMult() { return fmOperatorBank.fbMult[idx_]; }
 
     inline void __attribute__((always_inline)) IRAM_ATTR updatePhaseInc() {
-        float f = baseFreq_ * ratio_ + detune_;
-        phaseInc_ = f * DIV_SAMPLE_RATE;
+        fmOperatorBank.phaseInc[idx_] = phaseIncFor(baseFreq_, ratio_, detune_);
     }
 
-    // Internal state
+    // 2^32 = one turn per sample; the phase wraps by itself, so the period is exact
+    static inline uint32_t phaseIncFor(float baseFreq, float ratio, float detune) {
+        float f = baseFreq * ratio + detune;
+        return (uint32_t)(int64_t)((double)f * (4294967296.0 / (double)SAMPLE_RATE));
+    }
+
+    static inline float feedbackCoeff(float fb) {
+        return (fb == 0) ? 0.0f : (1.0f / powf(2.0f, (7.0f - fb)));
+    }
+
+    static inline float fmLevelFor(float volume) {
+        return 0.1f * powf(161.0f, volume) - 0.1f;
+    }
+
+    static inline void sineShape(Waveform wf, float& sign, uint32_t& offset) {
+        switch (wf.value) {
+            case Waveform::Sine:        sign =  1.0f; offset = 0;           break;
+            case Waveform::Cosine:      sign =  1.0f; offset = 0x40000000u; break;
+            case Waveform::NegSine:     sign = -1.0f; offset = 0;           break;
+            case Waveform::NegCosine:   sign = -1.0f; offset = 0x40000000u; break;
+            default:                    sign =  1.0f; offset = 0;           break;
+        }
+    }
+
+    // Patch parameters; the render state lives in fmOperatorBank[idx_]
+    int   idx_        = 0;
     float sampleRate_ = 44100.f;
     float baseFreq_   = 440.f;
     float ratio_      = 1.f;
@@ -204,16 +455,6 @@ private:
     float fb_         = 0.f;
     float fbMod_      = 1.f;
     float feedback_   = 0.f;
-    float fbMult_     = 0.f;
     float volume_     = 0.8f;
-
-    float phase_      = 0.f;
-    float phaseInc_   = 0.f;
-    float lastOut_    = 0.f;
-
-    float outLevel_   = 0.8f;
-    float fmLevel_    = 0.0f;
-    float amLevel_    = 0.0f;
-    float amOffset_   = 1.0f;
     Waveform waveform_;
 };
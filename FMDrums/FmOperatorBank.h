@@ -0,0 +1,72 @@
+/*
+* FmOperatorBank - render state of every FM operator, as a structure of arrays
+*
+* Each field is one array indexed [operator position][voice slot], so what
+* the block loops read is packed together for all voices, while the patch
+* parameters that are only touched on changes (ratio, detune, volume...)
+* stay in FmOperator. Every FmVoice6 takes one voice slot on construction.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include "config.h"
+#include "platform.h"
+
+struct FmOperatorBank {
+    static constexpr int NumOps = 6;
+    static constexpr int NumVoices = OP_BANK_VOICES;
+    static constexpr int Size = NumOps * NumVoices;
+
+    static inline int index(int op, int voice) { return op * NumVoices + voice; }
+
+    // running state; phases are 32-bit, 2^32 = one turn, and simply wrap around
+    alignas(16) uint32_t phase[Size];
+    alignas(16) float lastOut[Size];
+#ifdef FIXED_POINT_ENGINE
+    alignas(16) int32_t lastOutQ[Size];   // Q30
+#endif
+
+    // derived from the patch, read once per block
+    alignas(16) uint32_t phaseInc[Size];
+    alignas(16) float fbMult[Size];
+    alignas(16) float fmLevel[Size];
+    alignas(16) float outLevel[Size];
+    alignas(16) float amLevel[Size];
+    alignas(16) float amOffset[Size];
+    alignas(16) float sineSign[Size];
+    alignas(16) uint32_t sineOffset[Size];
+
+    bool used[NumVoices];
+
+    int acquireVoice() {
+        for (int v = 0; v < NumVoices; ++v) {
+            if (!used[v]) {
+                used[v] = true;
+                return v;
+            }
+        }
+        ESP_LOGE("FmOperatorBank", "No free slot, raise OP_BANK_VOICES; sharing the last one");
+        return NumVoices - 1;
+    }
+
+    void releaseVoice(int v) {
+        if (v >= 0 && v < NumVoices) used[v] = false;
+    }
+
+    // clears the running state of all operators of a voice
+    void resetVoice(int v) {
+        for (int op = 0; op < NumOps; ++op) {
+            phase[index(op, v)] = 0;
+            lastOut[index(op, v)] = 0.0f;
+#ifdef FIXED_POINT_ENGINE
+            lastOutQ[index(op, v)] = 0;
+#endif
+        }
+    }
+};
+
+// zero-initialised, lives in internal DRAM
+inline FmOperatorBank fmOperatorBank;
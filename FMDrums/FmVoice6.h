@@ -3,32 +3,79 @@
 #include "FmOperator.h"
 #include "FmPatch.h"
 #include "svf_morph.h"
-#include "Adsr.h"
+#include "adsr.h"
 #include <array> 
+#include <utility>
+#include <atomic>
 
 struct FmDrumPatch; 
 
 #define NUM_ALGOS 18
 
+// A patch compiled into the values a voice actually runs on, see FmVoice6::compile().
+// Built when a patch is loaded or edited; applying it on note-on is plain copying.
+struct FmVoicePatch {
+    FmOperator::Params ops[6];
+    Adsr::Params env;
+    SvfFilter::Params filter;
+    float baseFreq;
+    float volume;
+    float pan, panL, panR;
+    float reverbSend;
+    uint8_t algo;
+    uint8_t chokeGroup;
+    uint8_t renderer;   // index into the FmVoice6 renderer table
+    bool useFilter;
+#ifdef SAMPLE_CACHE
+    Adsr::Params gateEnv;   // the envelope of a cached one-shot, see FmVoice6::playCached()
+#endif
+};
+
+#ifdef SAMPLE_CACHE
+// A patch pre-rendered by SampleCache, played back instead of running the operators
+struct CachedSample {
+    const int16_t* data = nullptr;
+    uint32_t length = 0;
+    float scale = 0.0f;                 // data[i] * scale = the voice output at volume and velocity 1
+    std::atomic<uint16_t> users{0};     // voices playing it; SampleCache frees it only at 0
+};
+#endif
+
 class IRAM_ATTR FmVoice6 {
 public:
     FmVoice6() {
 
         if (!buffer) {
-            buffer = (float*) heap_caps_malloc(DMA_BUFFER_LEN * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            // 16-byte aligned for the DspKernels PIE path
+            buffer = (float*) heap_caps_aligned_alloc(16, DMA_BUFFER_LEN * sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
             if (!buffer) {
                 ESP_LOGE("FmVoice6", "Failed to allocate voice buffer");
                 // Optional: fallback to internal RAM
-                buffer = (float*) heap_caps_malloc(DMA_BUFFER_LEN * sizeof(float), MALLOC_CAP_8BIT);
+                buffer = (float*) heap_caps_aligned_alloc(16, DMA_BUFFER_LEN * sizeof(float), MALLOC_CAP_8BIT);
             }
         }
         setSampleRate(SAMPLE_RATE);
         for (auto& op : ops) op.setSampleRate(sampleRate_);
         filter.init(sampleRate_);
         env.init(sampleRate_);
+        updateRenderer();
+    }
+
+    ~FmVoice6() {
+        fmOperatorBank.releaseVoice(slot_);
     }
-    static constexpr int NumOps = 6;
+
+    static constexpr int NumOps = FmOperatorBank::NumOps;
     static constexpr int NumAlgos = NUM_ALGOS;
+    static constexpr uint8_t MaxRenderCost = 60;    // getRenderCost() of the dearest renderer
+
+    // operators each algorithm actually renders, bit i = ops[i]
+    static constexpr uint8_t algoOpMask[NUM_ALGOS] = {
+        0b100001, 0b110001, 0b100001, 0b111001, 0b111001, 0b111101,
+        0b111001, 0b111111, 0b111001, 0b111111, 0b110111, 0b111111,
+        0b111111, 0b111111, 0b101001, 0b111111, 0b111101, 0b111111
+    };
+
     inline uint8_t& getAlgorithm()  { return algo_; }
     inline uint8_t& getChokeGroup()  { return chokeGroup_; }
     inline FmOperator& getOp(int i) { return ops[i]; }
@@ -52,6 +99,7 @@ public:
 
     void setFilterActive(bool active) {
         useFilter_ = active ? true : false;
+        updateRenderer();
     }
 
     void setOperatorParams(int i, float ratio, float detune, float feedback = 0.f, float vol = 0.8f, Waveform wf = Waveform::Sine) {
@@ -61,6 +109,7 @@ public:
             ops[i].setFeedback(feedback);
             ops[i].setVolume(vol);
             ops[i].setWaveform(wf);
+            updateRenderer();
         }
     }
 
@@ -85,6 +134,7 @@ public:
 
     void setAlgorithm(uint8_t id) {
         algo_ = (id < NumAlgos) ? id : 0;
+        updateRenderer();
     }
 
     void setChokeGroup(uint8_t id) {
@@ -106,17 +156,17 @@ public:
     }
 
     void reset() {
-        for (auto& op : ops) op.reset();
+        fmOperatorBank.resetVoice(slot_);
         filter.reset();
     }
 
-    void noteOn(float hz, uint8_t midiNote , float vel = 1.f) {
+    void noteOn(uint8_t midiNote, float vel = 1.f) {
         reset();
-     //   if (hz > 0) setFrequency(hz); else setFrequency(baseFreq_);
         velocity_ = vel; // 0.0 .. 1.0
         note_ = midiNote;
         velocityVol_ = vel * volume_;
         veloMult_ = velocity_ * veloMod_;
+        quietBlocks_ = 0;
         env.retrigger(Adsr::END_NOW);
     }
 
@@ -128,195 +178,117 @@ public:
         env.end(Adsr::END_SEMI_FAST);
     }
 
-    void __attribute__((always_inline)) process() {
-
-        switch(algo_) {
-            case 0:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] = velocityVol_ * filter.processMorph(algo0_2c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo0_2c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 1:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo1_3c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo1_3c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 2:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo2_1m_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo2_1m_1c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 3:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo3_2m_2c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo3_2m_2c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 4:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo4_3ms_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo4_3ms_1c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 5:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo5_4ms_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo5_4ms_1c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 6:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo6_2m_1m_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo6_2m_1m_1c(*this, env.process());
-                    } 
-                }
-                break;
-            case 7:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo7_3m_1m_2c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo7_3m_1m_2c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 8:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo8_2m_1m_1c(*this, env.process()) );
-                    }
-                    buffer[i] =  velocityVol_ *  algo8_2m_1m_1c(*this, env.process()); 
-                }
-                break;
-            case 9:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo9_2m_2m_2c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo9_2m_2m_2c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 10:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo10_2m_3c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo10_2m_3c(*this, env.process());
-                    } 
-                }
-                break;
-            case 11:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo11_3m_3c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo11_3m_3c(*this, env.process());
-                    } 
-                }
-                break;
-            case 12:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo12_2m_4c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo12_2m_4c(*this, env.process());
-                    }
-                }
-                break;
-            case 13:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo13_1m_5c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo13_1m_5c(*this, env.process());
-                    }
-                }
-                break;
-            case 14:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo14_2m_1amp_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo14_2m_1amp_1c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 15:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo15_2m_2amp_2c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo15_2m_2amp_2c(*this, env.process()); 
-                    }
-                }
-                break;
-            case 16:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo16_2m_2amp_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo16_2m_2amp_1c(*this, env.process());
-                    }
-                }
-                break;
-            case 17:
-                for (int i = 0; i < DMA_BUFFER_LEN; ++i) { 
-                    if (useFilter_) {
-                        buffer[i] =  velocityVol_ * filter.processMorph(algo17_4m_1amp_1c(*this, env.process()) );
-                    } else {
-                        buffer[i] =  velocityVol_ *  algo17_4m_1amp_1c(*this, env.process()); 
-                    }
-                }
-                break;
-            default:
-                memset(buffer, 0, sizeof(buffer));  
-                break;
+    // Silence detection, once per block with whether the block stayed below the
+    // threshold: true once the envelope is decaying and SILENCE_HOLD_BLOCKS blocks in a
+    // row were quiet, then the voice can be ended without anything audible lost
+    bool trackSilence(bool quiet) {
+        if (!quiet || !env.isDecaying()) {
+            quietBlocks_ = 0;
+            return false;
         }
+        return ++quietBlocks_ >= SILENCE_HOLD_BLOCKS;
+    }
+
+    // a quick fade to silence that does not click, for the allocator's CPU budget:
+    // the voice stays active, and costs its render, until the envelope is idle
+    void fadeOut() {
+        env.end(Adsr::END_FAST);
+    }
+
+    void retire() {
+        env.end(Adsr::END_NOW);
+        quietBlocks_ = 0;
+#ifdef SAMPLE_CACHE
+        dropSample();
+#endif
+    }
+
+#ifdef SAMPLE_CACHE
+    // Plays s, rendered from the patch of applyCompiled(c), instead of the operators;
+    // call between applyCompiled() and noteOn(). The envelope only gates the sample:
+    // it holds 1 for as long as the sample can be, so note-off and choke fade it out
+    // with the patch release and the semi-fast release.
+    void playCached(CachedSample* s, const FmVoicePatch& c) {
+        if (!s) return;
+        s->users.fetch_add(1, std::memory_order_acq_rel);
+        sample_ = s;
+        samplePos_ = 0;
+        env.setParams(c.gateEnv);
+        renderer_ = SampleRenderer;
+        render_ = &renderSample;
     }
- 
+#endif
+
+    // renders one block with the renderer picked by updateRenderer()
+    inline void __attribute__((always_inline)) process() {
+        render_(*this, buffer, DMA_BUFFER_LEN);
+    }
+
+    // renders samples [start, start + n) of the block buffer, so that events can
+    // be applied in the middle of a block
+    inline void __attribute__((always_inline)) process(int start, int n) {
+        render_(*this, buffer + start, n);
+    }
+
     bool isActive() const {
         return env.isRunning();
     }
 
-    void applyPatch(const FmDrumPatch& p) {
-        setAhdsr(p.attack, p.hold, p.decay, p.sustain, p.release);
-        setAlgorithm(p.algoIndex);
-        setChokeGroup(p.chokeGroup);
-        setFrequency(p.baseFreq);
-        setVolume(p.volume);
-        setPan(p.pan);
-        setReverbSend(p.reverbSend);
-        filter.setFreqHz(p.filterFreqHz);
-        filter.setResonance(p.filterReso);
-        filter.setMorph(p.filterMorph);
-        setFilterActive(p.useFilter!=0);
-        for (int i = 0; i < 6; ++i) {
-            setOperatorParams(i, p.ops[i].ratio, p.ops[i].detune, p.ops[i].feedback, p.ops[i].volume, p.ops[i].waveform);
+    inline uint8_t getRenderCost() const { return rendererCost(renderer_); }
+    inline uint8_t getRenderer() const { return renderer_; }   // for VoiceBench
+
+    // everything a patch needs that costs a pow/exp/sin, done once per patch edit
+    // instead of once per hit
+    static FmVoicePatch compile(const FmDrumPatch& p) {
+        FmVoicePatch c;
+        c.algo = (p.algoIndex < NumAlgos) ? p.algoIndex : 0;
+        c.chokeGroup = p.chokeGroup;
+        c.baseFreq = p.baseFreq;
+        c.volume = p.volume;
+        c.pan = p.pan;
+        c.panR = sin_lut(0.125f + 0.125f * p.pan);
+        c.panL = sin_lut(0.125f - 0.125f * p.pan);
+        c.reverbSend = fclamp(p.reverbSend, 0.f, 1.f);
+        c.useFilter = (p.useFilter != 0);
+        c.env = Adsr::makeParams(SAMPLE_RATE, p.attack, p.hold, p.decay, p.sustain, p.release);
+        c.filter = SvfFilter::makeParams(SAMPLE_RATE, p.filterFreqHz, p.filterReso, p.filterMorph);
+        bool sineOnly = true;
+        for (int i = 0; i < NumOps; ++i) {
+            const FmOpParams& o = p.ops[i];
+            c.ops[i] = FmOperator::makeParams(p.baseFreq, o.ratio, o.detune, o.feedback, o.volume, o.waveform);
+            if ((algoOpMask[c.algo] & (1 << i)) && !FmOperator::isSineClass(o.waveform)) sineOnly = false;
         }
+        c.renderer = rendererIndex(c.algo, c.useFilter, sineOnly);
+#ifdef SAMPLE_CACHE
+        c.gateEnv = Adsr::makeParams(SAMPLE_RATE, 0.0f, SAMPLE_CACHE_MAX_MS * 0.001f + 1.0f, 0.0f, 1.0f, p.release);
+#endif
+        return c;
+    }
+
+    // the note-on path: no transcendental math, just copies
+    void applyCompiled(const FmVoicePatch& c) {
+        env.setParams(c.env);
+        algo_ = c.algo;
+        chokeGroup_ = c.chokeGroup;
+        baseFreq_ = c.baseFreq;
+        volume_ = c.volume;
+        velocityVol_ = volume_ * velocity_;
+        pan_ = c.pan;
+        panL_ = c.panL;
+        panR_ = c.panR;
+        reverbSend_ = c.reverbSend;
+        filter.setParams(c.filter);
+        useFilter_ = c.useFilter;
+        for (int i = 0; i < NumOps; ++i) ops[i].setParams(c.ops[i]);
+#ifdef SAMPLE_CACHE
+        dropSample();
+#endif
+        renderer_ = c.renderer;
+        render_ = renderTable()[renderer_];
+    }
+
+    void applyPatch(const FmDrumPatch& p) {
+        applyCompiled(compile(p));
     }
 
     FmDrumPatch toPatch(const char* name = "Perc") const {
@@ -346,12 +318,12 @@ public:
         return p;
     }
 
+    // the higher, the sooner the voice is stolen; of two equally quiet voices the
+    // one that costs more CPU goes first
     inline float getStealScore() const {
         if (!isActive()) return 1e6f; // Prefer stealing inactive
-  
-     //   float cost = patch.cost > 0.01f ? patch.cost : 1.0f;
         float envPenalty = env.getPenalty();
-        return envPenalty * velocityVol_ ; // / cost;
+        return envPenalty * velocityVol_ * getRenderCost();
     }
 
    inline uint8_t getNote() const {
@@ -369,187 +341,427 @@ private:
     float velocityVol_ = 1.0f;
     uint8_t note_ = 255;
     bool useFilter_ = true;
+    uint16_t quietBlocks_ = 0;     // see trackSilence()
     uint8_t algo_ = 0;
     uint8_t chokeGroup_ = 0;
     float pan_ = 0.f;
     float panL_ = ONE_DIV_SQRT2;
     float panR_ = ONE_DIV_SQRT2;
     float reverbSend_ = 0.1f;
-    std::array<FmOperator, NumOps> ops;
+    int slot_ = fmOperatorBank.acquireVoice();   // must precede ops
+    std::array<FmOperator, NumOps> ops = makeOps(slot_, std::make_index_sequence<NumOps>{});
     Adsr env;
     SvfFilter filter;
 
-    using AlgoFn = float(*)(FmVoice6&, float);
+    using RenderFn = void(*)(FmVoice6&, float*, int);
+    RenderFn render_ = &renderBlock<0, false, WaveClass::Any>;
+    uint8_t renderer_ = 0;   // index of render_ in renderTable(), or SampleRenderer
+    static constexpr uint8_t SampleRenderer = NUM_ALGOS * 4;
+#ifdef SAMPLE_CACHE
+    CachedSample* sample_ = nullptr;   // see playCached()
+    uint32_t samplePos_ = 0;
+
+    void dropSample() {
+        if (!sample_) return;
+        sample_->users.fetch_sub(1, std::memory_order_acq_rel);
+        sample_ = nullptr;
+        updateRenderer();
+    }
+
+    // the cached one-shot, gain and gate envelope applied; ends the voice at its end
+    static void IRAM_ATTR renderSample(FmVoice6& v, float* buf, int n) {
+        alignas(16) float env[BlockLen];
+        v.env.processBlock(env, n);
+        const CachedSample* s = v.sample_;
+        const uint32_t left = s->length - v.samplePos_;
+        const int m = ((uint32_t)n < left) ? n : (int)left;
+        const int16_t* d = s->data + v.samplePos_;
+        const float g = s->scale * v.velocityVol_;
+        for (int i = 0; i < m; ++i) buf[i] = (float)d[i] * g * env[i];
+        for (int i = m; i < n; ++i) buf[i] = 0.0f;
+        v.samplePos_ += m;
+        if (v.samplePos_ >= s->length || !v.env.isRunning()) v.retire();
+    }
+#endif
+
+    // picks the block renderer specialised for the current algorithm, filter state
+    // and waveforms; call whenever any of them changes
+    void updateRenderer() {
+        bool sineOnly = true;
+        for (int i = 0; i < NumOps; ++i) {
+            if ((algoOpMask[algo_] & (1 << i)) && !ops[i].isSineClass()) sineOnly = false;
+        }
+        renderer_ = rendererIndex(algo_, useFilter_, sineOnly);
+        render_ = renderTable()[renderer_];
+    }
+
+    static inline uint8_t rendererIndex(uint8_t algo, bool filter, bool sineOnly) {
+        return algo * 4 + (filter ? 2 : 0) + (sineOnly ? 1 : 0);
+    }
+
+    // relative cost of each renderer, for the voice budget and for splitting voices
+    // between the cores: the worst waveform of each as measured by VoiceBench, which
+    // prints this table, the dearest renderer being MaxRenderCost. Measured with the
+    // host build (host/bench.cpp, 4000 blocks); the board's own run of VoiceBench
+    // prints the table to paste here, with the VOICE_COST_BUDGET that goes with it.
+    static constexpr uint8_t renderCostTable[NumAlgos * 4] = {
+        // any, sine only, any + filter, sine only + filter
+        29, 29, 42, 42,   // 0
+        33, 32, 45, 45,   // 1
+        28, 26, 41, 41,   // 2
+        38, 35, 50, 48,   // 3
+        37, 32, 54, 51,   // 4
+        42, 37, 55, 49,   // 5
+        36, 32, 49, 46,   // 6
+        45, 38, 57, 53,   // 7
+        36, 31, 48, 46,   // 8
+        47, 39, 60, 53,   // 9
+        41, 39, 54, 52,   // 10
+        44, 42, 58, 54,   // 11
+        45, 41, 54, 55,   // 12
+        44, 39, 55, 57,   // 13
+        31, 30, 47, 45,   // 14
+        44, 42, 58, 53,   // 15
+        40, 35, 52, 47,   // 16
+        45, 37, 59, 50,   // 17
+    };
+
+    // a cached sample is a copy and a multiply per sample, next to nothing
+    static inline uint8_t rendererCost(uint8_t renderer) {
+        if (renderer == SampleRenderer) return 1;
+        return renderCostTable[renderer];
+    }
+
+    static const std::array<RenderFn, NumAlgos * 4>& renderTable() {
+        static const auto renderers = makeRenderTable(std::make_index_sequence<NumAlgos * 4>{});
+        return renderers;
+    }
+
+    template<size_t... I>
+    static std::array<FmOperator, NumOps> makeOps(int slot, std::index_sequence<I...>) {
+        return {{ FmOperator(FmOperatorBank::index(I, slot))... }};
+    }
+
+    template<size_t... I>
+    static std::array<RenderFn, sizeof...(I)> makeRenderTable(std::index_sequence<I...>) {
+        return {{ &renderBlock<I / 4, ((I / 2) & 1) != 0, (I & 1) ? WaveClass::Sine : WaveClass::Any>... }};
+    }
+
+    // what the operators exchange: float, or Q-format integers with FIXED_POINT_ENGINE
+#ifdef FIXED_POINT_ENGINE
+    using Sample = int32_t;
+#else
+    using Sample = float;
+#endif
+
+    // renders n <= BlockLen samples into buf
+    template<int A, bool F, WaveClass W>
+    static void IRAM_ATTR renderBlock(FmVoice6& v, float* buf, int n) {
+#ifdef FIXED_POINT_ENGINE
+        // the operators run in Q formats (see FmOperator::processBlock), the filter and everything after in float
+        alignas(16) float envf[BlockLen];
+        alignas(16) int32_t env[BlockLen], acc[BlockLen];
+        v.env.processBlock(envf, n);
+        for (int i = 0; i < n; ++i) env[i] = q31_sat(envf[i]);
+        v.algo<A, W>(env, acc, n);
+        const float g = F ? (1.0f / 16777216.0f) : (v.velocityVol_ / 16777216.0f);
+        for (int i = 0; i < n; ++i) buf[i] = (float)acc[i] * g;
+        if constexpr (F) v.filter.processMorphBlock(buf, n, v.velocityVol_);
+#else
+        alignas(16) float env[BlockLen];
+        v.env.processBlock(env, n);
+        v.algo<A, W>(env, buf, n);
+        if constexpr (F) v.filter.processMorphBlock(buf, n, v.velocityVol_);
+        else             scaleBlock(buf, v.velocityVol_, n);
+#endif
+    }
+
+    template<int A, WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo(const Sample* e, Sample* out, int n) {
+        if constexpr (A == 0)       algo0_2c<W>(*this, e, out, n);
+        else if constexpr (A == 1)  algo1_3c<W>(*this, e, out, n);
+        else if constexpr (A == 2)  algo2_1m_1c<W>(*this, e, out, n);
+        else if constexpr (A == 3)  algo3_2m_2c<W>(*this, e, out, n);
+        else if constexpr (A == 4)  algo4_3ms_1c<W>(*this, e, out, n);
+        else if constexpr (A == 5)  algo5_4ms_1c<W>(*this, e, out, n);
+        else if constexpr (A == 6)  algo6_2m_1m_1c<W>(*this, e, out, n);
+        else if constexpr (A == 7)  algo7_3m_1m_2c<W>(*this, e, out, n);
+        else if constexpr (A == 8)  algo8_2m_1m_1c<W>(*this, e, out, n);
+        else if constexpr (A == 9)  algo9_2m_2m_2c<W>(*this, e, out, n);
+        else if constexpr (A == 10) algo10_2m_3c<W>(*this, e, out, n);
+        else if constexpr (A == 11) algo11_3m_3c<W>(*this, e, out, n);
+        else if constexpr (A == 12) algo12_2m_4c<W>(*this, e, out, n);
+        else if constexpr (A == 13) algo13_1m_5c<W>(*this, e, out, n);
+        else if constexpr (A == 14) algo14_2m_1amp_1c<W>(*this, e, out, n);
+        else if constexpr (A == 15) algo15_2m_2amp_2c<W>(*this, e, out, n);
+        else if constexpr (A == 16) algo16_2m_2amp_1c<W>(*this, e, out, n);
+        else                        algo17_4m_1amp_1c<W>(*this, e, out, n);
+    }
+
+    // --- block helpers ---
+    static constexpr int BlockLen = DMA_BUFFER_LEN;
+    static constexpr OpMode Fm  = OpMode::Fm;
+    static constexpr OpMode Am  = OpMode::Am;
+    static constexpr OpMode Out = OpMode::Out;
+
+    static inline void __attribute__((always_inline)) IRAM_ATTR scaleBlock(float* buf, float g, int n) {
+        for (int i = 0; i < n; ++i) buf[i] *= g;
+    }
+
+    static inline void __attribute__((always_inline)) IRAM_ATTR mulBlock(float* out, const float* a, const float* b, int n) {
+        for (int i = 0; i < n; ++i) out[i] = a[i] * b[i];
+    }
+
+#ifdef FIXED_POINT_ENGINE
+    // g < 1
+    static inline void __attribute__((always_inline)) IRAM_ATTR scaleBlock(int32_t* buf, float g, int n) {
+        const int32_t q = q31_sat(g);
+        for (int i = 0; i < n; ++i) buf[i] = mul_q31(buf[i], q);
+    }
+
+    // b in Q31, the result keeps the format of a
+    static inline void __attribute__((always_inline)) IRAM_ATTR mulBlock(int32_t* out, const int32_t* a, const int32_t* b, int n) {
+        for (int i = 0; i < n; ++i) out[i] = mul_q31(a[i], b[i]);
+    }
+#endif
 
     // --- algorithm implementations ---
-    inline float __attribute__((always_inline)) IRAM_ATTR algo0_2c(FmVoice6& v, float e) {
+    // Each graph is a topologically ordered sequence of operator block calls:
+    // modulators first, into scratch buffers, then carriers into out.
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo0_2c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [0]→[out]→
         // [5]↗ 
-        return ONE_DIV_SQRT2 * (v.ops[0].outProcess(0.f, e) + v.ops[5].outProcess(0.0f, e));
+        v.ops[0].processBlock<Out, W>(nullptr, e, out, n);
+        v.ops[5].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo1_3c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo1_3c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [4]↘
         // [0]→[out]→
         // [5]↗ 
-        return ONE_DIV_SQRT3 * (v.ops[0].outProcess(0.f, e) + v.ops[5].outProcess(0.0f, e) + v.ops[4].outProcess(0.0f, e));
+        v.ops[0].processBlock<Out, W>(nullptr, e, out, n);
+        v.ops[5].processBlock<Out, W, true>(nullptr, e, out, n);
+        v.ops[4].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT3, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo2_1m_1c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo2_1m_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[0]→[out]→
-        float m = v.ops[5].fmProcess(0.0f, e);
-        return v.ops[0].outProcess(m, e);
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo3_2m_2c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo3_2m_2c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[0]→[out]→
         // [4]→[3]↗
-        float m5 = v.ops[5].fmProcess(0.0f, e);
-        float m4 = v.ops[4].fmProcess(0.0f, e);
-        return  ONE_DIV_SQRT2 * (v.ops[0].outProcess(m5, e) + v.ops[3].outProcess(m4, e));
+        alignas(16) Sample m5[BlockLen], m4[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m5, n);
+        v.ops[4].processBlock<Fm, W>(nullptr, e, m4, n);
+        v.ops[0].processBlock<Out, W>(m5, e, out, n);
+        v.ops[3].processBlock<Out, W, true>(m4, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo4_3ms_1c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo4_3ms_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[4]→[3]→[0]→[out]→
-        float m1 = v.ops[5].fmProcess(0.f, e);
-        float m2 = v.ops[4].fmProcess(m1, e);
-        float m3 = v.ops[3].fmProcess(m2, e);
-        return v.ops[0].outProcess(m3, e);
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W>(m, e, m, n);
+        v.ops[3].processBlock<Fm, W>(m, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo5_4ms_1c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo5_4ms_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[4]→[3]→[0]→[out]→
         //             [2]↗
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(m5, e);
-        float m3 = v.ops[3].fmProcess(m4, e);
-        float m2 = v.ops[2].fmProcess(0.f, e);
-        return ONE_DIV_SQRT2 * (v.ops[0].outProcess(m3, e) + v.ops[2].outProcess(m2, e));
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W>(m, e, m, n);
+        v.ops[3].processBlock<Fm, W>(m, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
+        v.ops[2].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo6_2m_1m_1c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo6_2m_1m_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]↘
         // [4]→[0]→[out]→
         // [3]↗
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(0.f, e);
-        float m3 = v.ops[3].fmProcess(0.f, e);
-        return v.ops[0].outProcess(m3 + m4 + m5, e);
+        alignas(16) Sample m[BlockLen];
+        v.ops[3].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W, true>(nullptr, e, m, n);
+        v.ops[5].processBlock<Fm, W, true>(nullptr, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo7_3m_1m_2c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo7_3m_1m_2c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[4]→[3]→[2]→[out]→
         //         [1]→[0]↗
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(m5, e);
-        float m3 = v.ops[3].fmProcess(m4, e);
-        float m1 = v.ops[1].fmProcess(0.f, e);
-        return ONE_DIV_SQRT2 * (v.ops[0].outProcess(m1, e) + v.ops[2].outProcess(m3, e));
-    }
-
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo8_2m_1m_1c(FmVoice6& v, float e) {
+        alignas(16) Sample m3[BlockLen], m1[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m3, n);
+        v.ops[4].processBlock<Fm, W>(m3, e, m3, n);
+        v.ops[3].processBlock<Fm, W>(m3, e, m3, n);
+        v.ops[1].processBlock<Fm, W>(nullptr, e, m1, n);
+        v.ops[0].processBlock<Out, W>(m1, e, out, n);
+        v.ops[2].processBlock<Out, W, true>(m3, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo8_2m_1m_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[3]→[0]→[out]→
         // [4]↗
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(0.f, e);
-        float m3 = v.ops[3].fmProcess(m5 + m4, e);
-        return v.ops[0].outProcess(m3, e);
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W, true>(nullptr, e, m, n);
+        v.ops[3].processBlock<Fm, W>(m, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
     }  
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo9_2m_2m_2c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo9_2m_2m_2c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [2]→[1]→[0]→[out]→
         // [5]→[4]→[3]↗
-        float m1 = v.ops[2].fmProcess(0.f, e);
-        float m2 = v.ops[1].fmProcess(m1, e);
-        float m3 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(m3, e);
-        return ONE_DIV_SQRT2 * (v.ops[0].outProcess(m2, e ) + v.ops[3].outProcess(m4, e)) ;
-    }
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo10_2m_3c(FmVoice6& v, float e) {
+        alignas(16) Sample m2[BlockLen], m4[BlockLen];
+        v.ops[2].processBlock<Fm, W>(nullptr, e, m2, n);
+        v.ops[1].processBlock<Fm, W>(m2, e, m2, n);
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m4, n);
+        v.ops[4].processBlock<Fm, W>(m4, e, m4, n);
+        v.ops[0].processBlock<Out, W>(m2, e, out, n);
+        v.ops[3].processBlock<Out, W, true>(m4, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo10_2m_3c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         //     [2]↘
         // [4]→[1]→[out]→
         // [5]→[0]↗
-        float m4 = v.ops[4].fmProcess(0.f, e);
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        return ONE_DIV_SQRT3 * (v.ops[0].outProcess(m5, e) + v.ops[1].outProcess(m4, e) + v.ops[2].outProcess(0.f, e));
+        alignas(16) Sample m4[BlockLen], m5[BlockLen];
+        v.ops[4].processBlock<Fm, W>(nullptr, e, m4, n);
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m5, n);
+        v.ops[0].processBlock<Out, W>(m5, e, out, n);
+        v.ops[1].processBlock<Out, W, true>(m4, e, out, n);
+        v.ops[2].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT3, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo11_3m_3c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo11_3m_3c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [1]→[0]↘
         // [3]→[2]→[out]→
         // [5]→[4]↗
-        float m1 = v.ops[1].fmProcess(0.f, e);
-        float m3 = v.ops[3].fmProcess(0.f, e);
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        return ONE_DIV_SQRT3 * (v.ops[0].outProcess(m1, e) + v.ops[2].outProcess(m3, e) + v.ops[4].outProcess(m5, e));
-    }
-
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo12_2m_4c(FmVoice6& v, float e) {
+        alignas(16) Sample m[BlockLen];
+        v.ops[1].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
+        v.ops[3].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[2].processBlock<Out, W, true>(m, e, out, n);
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Out, W, true>(m, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT3, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo12_2m_4c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[0]↘
         // [4]→[1]→[out]→
         //     [2]↗
         //     [3]↗
-        float m5 = v.ops[1].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(0.f, e);
-        return ONE_DIV_SQRT5 * (v.ops[0].outProcess(m5, e) + v.ops[1].outProcess(m4, e) + v.ops[2].outProcess(0.f, e) + v.ops[3].outProcess(0.f, e) );
-    }
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo13_1m_5c(FmVoice6& v, float e) {
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
+        v.ops[4].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[1].processBlock<Out, W, true>(m, e, out, n);
+        v.ops[2].processBlock<Out, W, true>(nullptr, e, out, n);
+        v.ops[3].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT5, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo13_1m_5c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [5]→[0]↘
         //    ↘[1]→[out]→
         //     [2]↗
         //     [3]↗
         //     [4]↗
-        float m5 = v.ops[1].fmProcess(0.f, e);
-        return ONE_DIV_SQRT5 * (v.ops[0].outProcess(m5, e) + v.ops[1].outProcess(m5, e) + v.ops[2].outProcess(0.f, e) + v.ops[3].outProcess(0.f, e) + v.ops[4].outProcess(0.f, e));
-    }
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo14_2m_1amp_1c(FmVoice6& v, float e) {
+        alignas(16) Sample m[BlockLen];
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
+        v.ops[1].processBlock<Out, W, true>(m, e, out, n);
+        v.ops[2].processBlock<Out, W, true>(nullptr, e, out, n);
+        v.ops[3].processBlock<Out, W, true>(nullptr, e, out, n);
+        v.ops[4].processBlock<Out, W, true>(nullptr, e, out, n);
+        scaleBlock(out, ONE_DIV_SQRT5, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo14_2m_1amp_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [3(amp)]↘
         //   [5]→[0]→[out]→
-        float amp3 = v.ops[3].amProcess(0.f); // positive amplitude 0..1
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        return  v.ops[0].outProcess(m5, e * amp3);
+        alignas(16) Sample amp[BlockLen], m[BlockLen];
+        v.ops[3].processBlock<Am, W>(nullptr, nullptr, amp, n); // positive amplitude 0..1
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        mulBlock(amp, amp, e, n);
+        v.ops[0].processBlock<Out, W>(m, amp, out, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo15_2m_2amp_2c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo15_2m_2amp_2c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         // [3(amp)]↘
         //     [5]→[0]→[out]→
         //     [4]→[1]↗
         // [2(amp)]↗
-        float amp3 = v.ops[3].amProcess(0.f) ; 
-        float amp2 = v.ops[2].amProcess(0.f) ; 
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(0.f, e);
-        return ONE_DIV_SQRT2 * (v.ops[0].outProcess(m5, e * amp3) + v.ops[1].outProcess(m4, e * amp2));
-    }
-
-    inline float __attribute__((always_inline)) IRAM_ATTR algo16_2m_2amp_1c(FmVoice6& v, float e) {
+        alignas(16) Sample amp[BlockLen], m[BlockLen];
+        v.ops[3].processBlock<Am, W>(nullptr, nullptr, amp, n);
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        mulBlock(amp, amp, e, n);
+        v.ops[0].processBlock<Out, W>(m, amp, out, n);
+        v.ops[2].processBlock<Am, W>(nullptr, nullptr, amp, n);
+        v.ops[4].processBlock<Fm, W>(nullptr, e, m, n);
+        mulBlock(amp, amp, e, n);
+        v.ops[1].processBlock<Out, W, true>(m, amp, out, n);
+        scaleBlock(out, ONE_DIV_SQRT2, n);
+    }
+
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo16_2m_2amp_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         //       [3(amp)]↘
         //         [5]→[0]→[out]→
         //         [4]↗
         // [2(amp)]↗
-        float amp3 =  v.ops[3].amProcess(0.f) ; // positive amplitude 0..1
-        float amp2 =  v.ops[2].amProcess(0.f) ; // positive amplitude 0..1
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(0.f, amp2);
-        return amp3 * v.ops[0].outProcess(m5 + m4, e)  ;
+        alignas(16) Sample amp[BlockLen], m[BlockLen];
+        v.ops[2].processBlock<Am, W>(nullptr, nullptr, amp, n); // positive amplitude 0..1
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W, true>(nullptr, amp, m, n);
+        v.ops[0].processBlock<Out, W>(m, e, out, n);
+        v.ops[3].processBlock<Am, W>(nullptr, nullptr, amp, n);
+        mulBlock(out, out, amp, n);
     }
 
-    inline float __attribute__((always_inline)) IRAM_ATTR algo17_4m_1amp_1c(FmVoice6& v, float e) {
+    template<WaveClass W>
+    inline void __attribute__((always_inline)) IRAM_ATTR algo17_4m_1amp_1c(FmVoice6& v, const Sample* e, Sample* out, int n) {
         //       [1]↘
         //   [5]→[4]→[0]→[out]→
         //     [2(amp)]↗
         // [3]↗
-        float m3 = v.ops[3].fmProcess(0.f, e);
-        float amp2 = v.ops[2].amProcess(m3); 
-        float m5 = v.ops[5].fmProcess(0.f, e);
-        float m4 = v.ops[4].fmProcess(m5, e);
-        float m1 = v.ops[1].fmProcess(0.f, e);
-        return  v.ops[0].outProcess(m1 + m4, e * amp2);
+        alignas(16) Sample amp[BlockLen], m[BlockLen], m5[BlockLen];
+        v.ops[3].processBlock<Fm, W>(nullptr, e, amp, n);
+        v.ops[2].processBlock<Am, W>(amp, nullptr, amp, n);
+        v.ops[5].processBlock<Fm, W>(nullptr, e, m5, n);
+        v.ops[1].processBlock<Fm, W>(nullptr, e, m, n);
+        v.ops[4].processBlock<Fm, W, true>(m5, e, m, n);
+        mulBlock(amp, amp, e, n);
+        v.ops[0].processBlock<Out, W>(m, amp, out, n);
     }
 
 };
@@ -0,0 +1,298 @@
+/*
+* KitFormat - the binary drumkit file (.fmk)
+*
+* A fixed header, a 128-byte index from note to record, a 16-byte mask of
+* which records are packed, and the distinct patches, each stored once however
+* many notes play it (a kit is mostly the same few patches). A record is a
+* PackedPatch (100 bytes) if the patch packs without loss, see PackedPatch.h,
+* or else the FmDrumPatch exactly as it lies in memory. The records load with
+* one read() into the top of the patch map, without a JSON document on the
+* heap; decodeRecords() and expandTable() then unpack them and copy them out
+* to their notes in place. The header carries a version, the float record size
+* and the record count, the reverb settings, a generation, and a CRC-32 of the
+* header and one of index, records and mask. Version 1 (128 float records, no
+* index), version 2 (no mask, float records) and version 3 (no generation)
+* files still load, as generation 0. The board and the host build share the layout
+* (both little-endian, same alignment); JSON stays the interchange format,
+* see DrumkitStorage and host/kitconv.cpp.
+*
+* Edits made since the kit file was written go to a journal (.fmj) next to
+* it: a small header, then fixed-size records appended one per edited patch
+* (or reverb change), each with its own CRC. Loading the kit replays them in
+* order; a record cut short by a power loss fails its CRC and ends the
+* replay there. Compaction writes the kit file anew and deletes the journal.
+* Every kit file written gets a generation above the one it replaces, and a
+* journal carries the generation of the kit file it was started for: a power
+* loss between writing the kit file and deleting the journal leaves a journal
+* of an older generation, which is dropped instead of being replayed over
+* the edits the new kit file already has.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include "FmPatch.h"
+#include "PackedPatch.h"
+
+namespace KitFormat {
+
+static constexpr char Magic[4] = { 'F', 'M', 'D', 'K' };
+static constexpr uint16_t Version = 4;
+static constexpr uint16_t NumPatches = 128;     // notes, and the most records a file holds
+static constexpr const char* Extension = ".fmk";
+
+static_assert(std::is_trivially_copyable<FmDrumPatch>::value, "patch records are copied as bytes");
+static_assert(sizeof(FmDrumPatch) == 196, "FmDrumPatch layout changed: bump KitFormat::Version");
+
+struct Header {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t numPatches;
+    uint16_t patchSize;
+    float reverbTime;
+    float reverbLevel;
+    float reverbDamp;
+    float reverbPreDelay;
+    uint32_t generation;    // version 4 on: one up with every write, see the journal
+    uint32_t patchCrc;      // CRC-32 of the index, the records and the mask, in that order
+    uint32_t headerCrc;     // CRC-32 of the header up to here
+};
+static_assert(sizeof(Header) == 40, "Header is written as bytes");
+
+// versions 1 to 3: the same without the generation
+struct HeaderV3 {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t numPatches;
+    uint16_t patchSize;
+    float reverbTime;
+    float reverbLevel;
+    float reverbDamp;
+    float reverbPreDelay;
+    uint32_t patchCrc;
+    uint32_t headerCrc;
+};
+static_assert(sizeof(HeaderV3) == 36, "HeaderV3 is read as bytes");
+
+static constexpr size_t TableSize = (size_t)NumPatches * sizeof(FmDrumPatch);
+static constexpr size_t IndexSize = NumPatches;    // version 2 on, after the header
+static constexpr size_t MaskSize = NumPatches / 8;  // version 3 on, after the index: bit k set, record k is packed
+
+// CRC-32 (IEEE 802.3, as zlib), a nibble at a time; pass the previous result to continue
+inline uint32_t crc32(const void* data, size_t len, uint32_t crc = 0) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ p[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (p[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+inline uint32_t headerCrc(const Header& h) {
+    return crc32(&h, offsetof(Header, headerCrc));
+}
+
+// numPatches: records written; patchCrc: crc32() of index, records and mask as written
+inline Header makeHeader(uint16_t numPatches, uint32_t patchCrc, float reverbTime, float reverbLevel, float reverbDamp,
+                         float reverbPreDelay, uint32_t generation) {
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.headerSize = sizeof(Header);
+    h.numPatches = numPatches;
+    h.patchSize = sizeof(FmDrumPatch);
+    h.reverbTime = reverbTime;
+    h.reverbLevel = reverbLevel;
+    h.reverbDamp = reverbDamp;
+    h.reverbPreDelay = reverbPreDelay;
+    h.generation = generation;
+    h.patchCrc = patchCrc;
+    h.headerCrc = headerCrc(h);
+    return h;
+}
+
+inline bool hasIndex(const Header& h) { return h.version >= 2; }
+inline bool hasMask(const Header& h) { return h.version >= 3; }
+
+// a header this build can read the table of
+inline bool checkHeader(const Header& h) {
+    const bool count = hasIndex(h) ? (h.numPatches >= 1 && h.numPatches <= NumPatches) : h.numPatches == NumPatches;
+    return memcmp(h.magic, Magic, sizeof(Magic)) == 0 && h.version >= 4 && h.version <= Version &&
+           h.headerSize == sizeof(Header) && count &&
+           h.patchSize == sizeof(FmDrumPatch) && h.headerCrc == headerCrc(h);
+}
+
+// The header from the first len bytes of a file (sizeof(Header) or what the file
+// has): a version 1 to 3 header is checked as it was written and comes back as
+// generation 0, with its own headerSize, where the index starts.
+inline bool readHeader(const uint8_t* bytes, size_t len, Header& h) {
+    HeaderV3 old;
+    if (len < sizeof(old)) return false;
+    memcpy(&old, bytes, sizeof(old));
+    if (old.version >= 4) {
+        if (len < sizeof(h)) return false;
+        memcpy(&h, bytes, sizeof(h));
+        return checkHeader(h);
+    }
+    const bool count = (old.version >= 2) ? (old.numPatches >= 1 && old.numPatches <= NumPatches)
+                                          : old.numPatches == NumPatches;
+    if (memcmp(old.magic, Magic, sizeof(Magic)) != 0 || old.version < 1 || old.headerSize != sizeof(old) || !count ||
+        old.patchSize != sizeof(FmDrumPatch) || old.headerCrc != crc32(&old, offsetof(HeaderV3, headerCrc)))
+        return false;
+    h = makeHeader(old.numPatches, old.patchCrc, old.reverbTime, old.reverbLevel, old.reverbDamp, old.reverbPreDelay, 0);
+    h.version = old.version;
+    h.headerSize = old.headerSize;
+    return true;
+}
+
+// The records to write: index[note] = record, first[record] = the note to write
+// it from. Records are numbered in the order their first note comes, so that
+// index[note] <= note, which expandTable() relies on. Returns the record count.
+inline int buildIndex(const FmDrumPatch patches[NumPatches], uint8_t index[NumPatches], uint8_t first[NumPatches]) {
+    int n = 0;
+    for (int note = 0; note < NumPatches; ++note) {
+        int k = 0;
+        while (k < n && memcmp(&patches[first[k]], &patches[note], sizeof(FmDrumPatch)) != 0) ++k;
+        if (k == n) first[n++] = note;
+        index[note] = k;
+    }
+    return n;
+}
+
+// an index read from a file with numPatches records that expandTable() can take
+inline bool checkIndex(const uint8_t index[NumPatches], int numPatches) {
+    for (int note = 0; note < NumPatches; ++note)
+        if (index[note] >= numPatches || index[note] > note) return false;
+    return true;
+}
+
+inline bool isPacked(const uint8_t mask[MaskSize], int record) {
+    return mask[record >> 3] & (1 << (record & 7));
+}
+
+// the size of the records a mask describes
+inline size_t recordBytes(int numPatches, const uint8_t mask[MaskSize]) {
+    size_t n = 0;
+    for (int k = 0; k < numPatches; ++k) n += isPacked(mask, k) ? sizeof(PackedPatch) : sizeof(FmDrumPatch);
+    return n;
+}
+
+// The records as read into the top bytes of the patch map, recordBytes() of
+// them: unpacks them to patches[0..numPatches). Record k is taken out before
+// patches[k] is written, and that cannot reach record k + 1, which starts at
+// least one FmDrumPatch per remaining record below the end.
+inline void decodeRecords(FmDrumPatch patches[NumPatches], int numPatches, const uint8_t mask[MaskSize]) {
+    const uint8_t* src = (const uint8_t*)patches + TableSize - recordBytes(numPatches, mask);
+    for (int k = 0; k < numPatches; ++k) {
+        if (isPacked(mask, k)) {
+            PackedPatch q;
+            memcpy(&q, src, sizeof(q));
+            src += sizeof(q);
+            unpackPatch(q, patches[k]);
+        } else {
+            FmDrumPatch p;
+            memcpy(&p, src, sizeof(p));
+            src += sizeof(p);
+            memcpy(&patches[k], &p, sizeof(p));
+        }
+    }
+}
+
+// patches[0..numPatches) hold the records as decoded: copies them out to their
+// notes, from the top down, so that each record is still in place when read
+inline void expandTable(FmDrumPatch patches[NumPatches], const uint8_t index[NumPatches]) {
+    for (int note = NumPatches - 1; note >= 0; --note)
+        if (index[note] != note) patches[note] = patches[index[note]];
+}
+
+// --- journal ---
+
+static constexpr char JournalMagic[4] = { 'F', 'M', 'D', 'J' };
+static constexpr uint16_t JournalVersion = 2;
+static constexpr const char* JournalExtension = ".fmj";
+
+struct JournalHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t generation;    // Header::generation of the kit file the records go on top of
+};
+static_assert(sizeof(JournalHeader) == 12, "JournalHeader is written as bytes");
+
+enum RecordKind : uint16_t {
+    PatchRecord = 1,    // payload: the FmDrumPatch of note
+    ReverbRecord = 2    // payload: time, level, damping, pre-delay ms as floats
+};
+
+struct JournalRecord {
+    uint16_t kind;
+    uint16_t note;
+    uint8_t payload[sizeof(FmDrumPatch)];
+    uint32_t crc;       // CRC-32 of the record up to here
+};
+static_assert(sizeof(JournalRecord) == 204, "JournalRecord is written as bytes");
+
+inline JournalHeader makeJournalHeader(uint32_t generation) {
+    JournalHeader h;
+    memcpy(h.magic, JournalMagic, sizeof(JournalMagic));
+    h.version = JournalVersion;
+    h.recordSize = sizeof(JournalRecord);
+    h.generation = generation;
+    return h;
+}
+
+// version 1 had no generation: which kit file it belongs to is unknown
+inline bool checkJournalHeader(const JournalHeader& h) {
+    return memcmp(h.magic, JournalMagic, sizeof(JournalMagic)) == 0 && h.version == JournalVersion &&
+           h.recordSize == sizeof(JournalRecord);
+}
+
+inline uint32_t recordCrc(const JournalRecord& r) {
+    return crc32(&r, offsetof(JournalRecord, crc));
+}
+
+inline JournalRecord makePatchRecord(uint8_t note, const FmDrumPatch& patch) {
+    JournalRecord r;
+    memset(&r, 0, sizeof(r));
+    r.kind = PatchRecord;
+    r.note = note;
+    memcpy(r.payload, &patch, sizeof(FmDrumPatch));
+    r.crc = recordCrc(r);
+    return r;
+}
+
+inline JournalRecord makeReverbRecord(const float settings[4]) {
+    JournalRecord r;
+    memset(&r, 0, sizeof(r));
+    r.kind = ReverbRecord;
+    memcpy(r.payload, settings, 4 * sizeof(float));
+    r.crc = recordCrc(r);
+    return r;
+}
+
+inline bool hasExtension(const char* path) {
+    const size_t n = strlen(path), e = strlen(Extension);
+    if (n < e) return false;
+    for (size_t i = 0; i < e; ++i) {
+        char c = path[n - e + i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != Extension[i]) return false;
+    }
+    return true;
+}
+
+} // namespace KitFormat
@@ -7,26 +7,34 @@
 #include "FmDrumSynth.h"
 #include "GmDrums.h"
 #include "FmOperator.h"
+#include "PackedPatch.h"
 #include "DrumkitStorage.h"
+#include "StorageTask.h"
 #include "AlgoDiagrams.h"
 
 extern TextGUI gui;
 extern FmDrumSynth synth;
+extern StorageTask storage;
 
 namespace MenuStructure {
 
 static FmDrumPatch patchClipboard;
 static bool hasPatchClipboard = false;
 
+// The patch of a note in the kit being edited, looked up on every access: a kit load
+// or a repack hands the GUI another patch array while an editor is open.
+inline FmDrumPatch& editedPatch(uint8_t note) { return synth.getPatchMap()[note & 127]; }
 
-MenuItem createAlgoChooserCustom(uint8_t& algoIndex) {
+
+MenuItem createAlgoChooserCustom(uint8_t note) {
+    auto algoIndex = [note]() -> uint8_t& { return editedPatch(note).algoIndex; };
     return MenuItem::Custom(
         "",  // Empty title since we're drawing custom content
-        [&](TextGUI& gui, U8G2& u8g2, int x, int y) {
+        [algoIndex](TextGUI& gui, U8G2& u8g2, int x, int y) {
             x = 0;
             y = 0;
             // Defensive check on algoIndex
-            int index = algoIndex;
+            int index = algoIndex();
             if (index < 0 || index >= FmVoice6::NumAlgos) {
                 index = 0;  // fallback safe index
             }
@@ -54,17 +62,17 @@ MenuItem createAlgoChooserCustom(uint8_t& algoIndex) {
             }
 
         },
-        [&](TextGUI& gui, int action) -> bool {
+        [algoIndex](TextGUI& gui, int action) -> bool {
             if (action == -1) {
-                algoIndex = (algoIndex == 0) ? (FmVoice6::NumAlgos - 1) : (algoIndex - 1);
+                algoIndex() = (algoIndex() == 0) ? (FmVoice6::NumAlgos - 1) : (algoIndex() - 1);
                 return true;
             } 
             else if (action == +1) {
-                algoIndex = (algoIndex + 1) % FmVoice6::NumAlgos;
+                algoIndex() = (algoIndex() + 1) % FmVoice6::NumAlgos;
                 return true;
             } 
             else if (action == 0) {
-                gui.updateParentItemTitle("Algorithm: " + String(algoIndex));
+                gui.updateParentItemTitle("Algorithm: " + String(algoIndex()));
                 return false;  // Pop submenu
             }
 
@@ -73,12 +81,12 @@ MenuItem createAlgoChooserCustom(uint8_t& algoIndex) {
     );
 }
 
-MenuItem createAlgoEntry(FmDrumPatch& patch) {
+MenuItem createAlgoEntry(uint8_t note) {
     return MenuItem::Action(
-        "Algorithm: " + String(patch.algoIndex),
-        [&patch](TextGUI& gui) {
+        "Algorithm: " + String(editedPatch(note).algoIndex),
+        [note](TextGUI& gui) {
             gui.enterSubmenu(
-                { createAlgoChooserCustom(patch.algoIndex) },
+                { createAlgoChooserCustom(note) },
                 "Select Algorithm"
             );
         }
@@ -111,144 +119,151 @@ inline int floatToIntRange(float f, int minInt, int maxInt, float minF, float ma
     return v;
 }
 
-inline std::vector<MenuItem> createOpEditor(FmOpParams& op) { 
+inline std::vector<MenuItem> createOpEditor(uint8_t note, int opIndex) {
+    auto op = [note, opIndex]() -> FmOpParams& { return editedPatch(note).ops[opIndex]; };
     return {
         MenuItem::Value("Ratio",
-            [&]() { return floatToIntRange(op.ratio, 0, 1000, 0.f, 10.f); },      // assuming ratio range 0..10
-            [&](int v) { op.ratio = intToFloatRange(v, 0, 1000, 0.f, 10.f); },
-            0, 1000, 1),
+            [op]() { return PatchSteps::Ratio.toInt(op().ratio); },
+            [op](int v) { op().ratio = PatchSteps::Ratio.toFloat(v); },
+            PatchSteps::Ratio.minInt, PatchSteps::Ratio.maxInt, 1),
 
         MenuItem::Value("Detune",
-            [&]() { return floatToIntRange(op.detune, -100, 100, -10.f, 10.f); },
-            [&](int v) { op.detune = intToFloatRange(v, -100, 100, -10.f, 10.f); },
-            -100, 100, 1),
+            [op]() { return PatchSteps::Detune.toInt(op().detune); },
+            [op](int v) { op().detune = PatchSteps::Detune.toFloat(v); },
+            PatchSteps::Detune.minInt, PatchSteps::Detune.maxInt, 1),
 
         MenuItem::Value("Feedback",
-            [&]() { return floatToIntRange(op.feedback, 0, 100, 0.f, 10.f); },    // assuming feedback max 10
-            [&](int v) { op.feedback = intToFloatRange(v, 0, 100, 0.f, 10.f); },
-            0, 100, 1),
+            [op]() { return PatchSteps::Feedback.toInt(op().feedback); },
+            [op](int v) { op().feedback = PatchSteps::Feedback.toFloat(v); },
+            PatchSteps::Feedback.minInt, PatchSteps::Feedback.maxInt, 1),
 
         MenuItem::Value("Volume",
-            [&]() { return floatToIntRange(op.volume, 0, 100, 0.f, 1.f); },
-            [&](int v) { op.volume = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-            0, 100, 1),
+            [op]() { return PatchSteps::OpVolume.toInt(op().volume); },
+            [op](int v) { op().volume = PatchSteps::OpVolume.toFloat(v); },
+            PatchSteps::OpVolume.minInt, PatchSteps::OpVolume.maxInt, 1),
 
         MenuItem::Option("Waveform",
-            [&]() { return int(op.waveform); },
-            [&](int v) { op.waveform = Waveform(v); },
+            [op]() { return int(op().waveform); },
+            [op](int v) { op().waveform = Waveform(v); },
             Waveform::optionNames())
     };
 }
 
 
-inline std::vector<MenuItem> createPatchEditor(FmDrumPatch& patch) {
+inline std::vector<MenuItem> createPatchEditor(uint8_t note) {
+    auto patch = [note]() -> FmDrumPatch& { return editedPatch(note); };
     std::vector<MenuItem> items;
 
-    items.push_back(createAlgoEntry(patch));
+    items.push_back(createAlgoEntry(note));
 
     items.push_back(MenuItem::Value("Base Freq",
-        [&]() { return int(patch.baseFreq + 0.5f); },   // freq in Hz, integer
-        [&](int v) { patch.baseFreq = float(v); },
-        0, 10000, 1));
+        [patch]() { return PatchSteps::BaseFreq.toInt(patch().baseFreq); },   // freq in Hz, integer
+        [patch](int v) { patch().baseFreq = PatchSteps::BaseFreq.toFloat(v); },
+        PatchSteps::BaseFreq.minInt, PatchSteps::BaseFreq.maxInt, 1));
 
     items.push_back(MenuItem::Value("Volume",
-        [&]() { return floatToIntRange(patch.volume, 0, 100, 0.f, 2.f); },
-        [&](int v) { patch.volume = intToFloatRange(v, 0, 100, 0.f, 2.f); },
-        0, 100, 1));
+        [patch]() { return PatchSteps::Volume.toInt(patch().volume); },
+        [patch](int v) { patch().volume = PatchSteps::Volume.toFloat(v); },
+        PatchSteps::Volume.minInt, PatchSteps::Volume.maxInt, 1));
         
     items.push_back(MenuItem::Value("Pan",
-        [&]() { return floatToIntRange(patch.pan, -100, 100, -1.f, 1.f); },
-        [&](int v) { patch.pan = intToFloatRange(v, -100, 100, -1.f, 1.f); },
-        -100, 100, 1));
+        [patch]() { return PatchSteps::Pan.toInt(patch().pan); },
+        [patch](int v) { patch().pan = PatchSteps::Pan.toFloat(v); },
+        PatchSteps::Pan.minInt, PatchSteps::Pan.maxInt, 1));
         
     items.push_back(MenuItem::Value("Reverb Send Lvl",
-        [&]() { return floatToIntRange(patch.reverbSend, 0, 100, 0.f, 1.f); },
-        [&](int v) { patch.reverbSend = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-        0, 100, 1));
+        [patch]() { return PatchSteps::Percent.toInt(patch().reverbSend); },
+        [patch](int v) { patch().reverbSend = PatchSteps::Percent.toFloat(v); },
+        PatchSteps::Percent.minInt, PatchSteps::Percent.maxInt, 1));
 
     items.push_back(MenuItem::Value("Velocity Mod",
-        [&]() { return floatToIntRange(patch.velocityMod, 0, 100, 0.f, 1.f); },
-        [&](int v) { patch.velocityMod = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-        0, 100, 1));
+        [patch]() { return PatchSteps::Percent.toInt(patch().velocityMod); },
+        [patch](int v) { patch().velocityMod = PatchSteps::Percent.toFloat(v); },
+        PatchSteps::Percent.minInt, PatchSteps::Percent.maxInt, 1));
 
     items.push_back(MenuItem::Value("Attack ms",
-        [&]() { return int(patch.attack * 1000 + 0.5f); },
-        [&](int v) { patch.attack = v / 1000.0f; },
-        0, 8000, 1));
+        [patch]() { return PatchSteps::Ms.toInt(patch().attack); },
+        [patch](int v) { patch().attack = PatchSteps::Ms.toFloat(v); },
+        PatchSteps::Ms.minInt, PatchSteps::Ms.maxInt, 1));
 
     items.push_back(MenuItem::Value("Hold ms",
-        [&]() { return int(patch.hold * 1000 + 0.5f); },
-        [&](int v) { patch.hold = v / 1000.0f; },
-        0, 8000, 1));
+        [patch]() { return PatchSteps::Ms.toInt(patch().hold); },
+        [patch](int v) { patch().hold = PatchSteps::Ms.toFloat(v); },
+        PatchSteps::Ms.minInt, PatchSteps::Ms.maxInt, 1));
 
     items.push_back(MenuItem::Value("Decay ms",
-        [&]() { return int(patch.decay * 1000 + 0.5f); },
-        [&](int v) { patch.decay = v / 1000.0f; },
-        0, 8000, 1));
+        [patch]() { return PatchSteps::Ms.toInt(patch().decay); },
+        [patch](int v) { patch().decay = PatchSteps::Ms.toFloat(v); },
+        PatchSteps::Ms.minInt, PatchSteps::Ms.maxInt, 1));
 
     items.push_back(MenuItem::Value("Sustain %",
-        [&]() { return floatToIntRange(patch.sustain, 0, 100, 0.f, 1.f); },
-        [&](int v) { patch.sustain = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-        0, 100, 1));
+        [patch]() { return PatchSteps::Percent.toInt(patch().sustain); },
+        [patch](int v) { patch().sustain = PatchSteps::Percent.toFloat(v); },
+        PatchSteps::Percent.minInt, PatchSteps::Percent.maxInt, 1));
 
     items.push_back(MenuItem::Value("Release ms",
-        [&]() { return int(patch.release * 1000 + 0.5f); },
-        [&](int v) { patch.release = v / 1000.0f; },
-        0, 8000, 1));
+        [patch]() { return PatchSteps::Ms.toInt(patch().release); },
+        [patch](int v) { patch().release = PatchSteps::Ms.toFloat(v); },
+        PatchSteps::Ms.minInt, PatchSteps::Ms.maxInt, 1));
 
     items.push_back(MenuItem::Toggle("Use Filter",
-        [&]() { return patch.useFilter; },
-        [&](bool v) {patch.useFilter = v; }
+        [patch]() { return patch().useFilter; },
+        [patch](bool v) {patch().useFilter = v; }
         ));
         
     items.push_back(MenuItem::Value("Filter Freq",
-        [&]() { return int(patch.filterFreqHz + 0.5f); },
-        [&](int v) { patch.filterFreqHz = float(v); },
-        0, 16000, 1));
+        [patch]() { return PatchSteps::FilterFreq.toInt(patch().filterFreqHz); },
+        [patch](int v) { patch().filterFreqHz = PatchSteps::FilterFreq.toFloat(v); },
+        PatchSteps::FilterFreq.minInt, PatchSteps::FilterFreq.maxInt, 1));
 
     items.push_back(MenuItem::Value("Resonance",
-        [&]() { return floatToIntRange(patch.filterReso, 0, 100, 0.f, 1.f); },
-        [&](int v) { patch.filterReso = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-        0, 100, 1));
+        [patch]() { return PatchSteps::Percent.toInt(patch().filterReso); },
+        [patch](int v) { patch().filterReso = PatchSteps::Percent.toFloat(v); },
+        PatchSteps::Percent.minInt, PatchSteps::Percent.maxInt, 1));
 
     items.push_back(MenuItem::Value("Filter Morph",
-        [&]() { return floatToIntRange(patch.filterMorph, 0, 100, 0.f, 1.f); },
-        [&](int v) { patch.filterMorph = intToFloatRange(v, 0, 100, 0.f, 1.f); },
-        0, 100, 1)
+        [patch]() { return PatchSteps::Percent.toInt(patch().filterMorph); },
+        [patch](int v) { patch().filterMorph = PatchSteps::Percent.toFloat(v); },
+        PatchSteps::Percent.minInt, PatchSteps::Percent.maxInt, 1)
     );
 
     char label[12];
     for (int i = 0; i < 6; ++i) {
         snprintf(label, sizeof(label), "Op %d", i);
         int opIndex = i;
-        items.push_back(MenuItem::Submenu(String(label), [patchPtr = &patch, opIndex]() -> std::vector<MenuItem> {
-            return createOpEditor(patchPtr->ops[opIndex]);
+        items.push_back(MenuItem::Submenu(String(label), [note, opIndex]() -> std::vector<MenuItem> {
+            return createOpEditor(note, opIndex);
         }));
 
     }
 
     items.push_back(MenuItem::Value("Choke Group",
-        [&]()  { return patch.chokeGroup; },
-        [&](int v) { patch.chokeGroup = v ; },
+        [patch]()  { return patch().chokeGroup; },
+        [patch](int v) { patch().chokeGroup = v ; },
         0, 15, 1)
     );
 
 
-    items.emplace_back(MenuItem::Action("Copy Patch", [&](TextGUI& gui) {
-        patchClipboard = patch;
+    items.emplace_back(MenuItem::Action("Copy Patch", [patch](TextGUI& gui) {
+        patchClipboard = patch();
         hasPatchClipboard = true;
         gui.message("Copied patch");
     }));
 
-    items.push_back(MenuItem::Action("Paste Patch", [&](TextGUI& gui) {
+    items.push_back(MenuItem::Action("Paste Patch", [patch](TextGUI& gui) {
         if (hasPatchClipboard) {
-            patch = patchClipboard;
+            patch() = patchClipboard;
             gui.message("Pasted patch");
         } else {
             gui.message("Clipboard empty");
         }
     }));
 
+    // to PRESET_DIR under the patch name, written by the storage task
+    items.push_back(MenuItem::Action("Export Preset", [patch](TextGUI& gui) {
+        storage.post(StorageTask::EXPORT_PRESET, String(), &patch());
+    }));
+
 
 
     return items;
@@ -257,15 +272,14 @@ inline std::vector<MenuItem> createPatchEditor(FmDrumPatch& patch) {
 
 inline std::vector<MenuItem> createDrumkitEditor() {
     std::vector<MenuItem> items;
-    FmDrumPatch* patchMap = synth.getPatchMap();
- 
+
     for (int note = 0; note < 128; ++note) {
         const char* name = gmDrumNoteName(static_cast<GmDrumNote>(note));
         auto item = MenuItem::Action(
             String(note) + ": " + name,
-            [note, patchMap, name](TextGUI& gui) {
+            [note, name](TextGUI& gui) {
                 gui.enterSubmenu(
-                    createPatchEditor(patchMap[note]),
+                    createPatchEditor(note),
                     String(note) + ": " + name ,
                     nullptr,
                     note
@@ -278,27 +292,72 @@ inline std::vector<MenuItem> createDrumkitEditor() {
     return items;
 }
 
+#ifdef TASK_BENCHMARKING
+// Live render profile in us: mean, p99 and max per stage over the last few hundred
+// blocks. Click the first line to restart the counters.
+inline std::vector<MenuItem> createProfilerMenu() {
+    static const char* labels[RenderProfiler::NUM_STAGES + 1] = { "voice", "mix", "reverb", "output", "i2s", "busy" };
+    auto stats = std::make_shared<RenderProfiler::Stats>();
+    auto stamp = std::make_shared<uint32_t>(millis() - 1000);
+    auto fresh = [stats, stamp]() -> const RenderProfiler::Stats& {
+        if (millis() - *stamp >= 500) {
+            RenderProfiler::Stats st;
+            if (renderProfiler.snapshot(st)) *stats = st;
+            *stamp = millis();
+        }
+        return *stats;
+    };
+
+    std::vector<MenuItem> items;
+    auto summary = MenuItem::Action("", [](TextGUI& gui) { renderProfiler.reset(); });
+    summary.dynamicTitle = [fresh]() {
+        const auto& st = fresh();
+        char buf[32];
+        snprintf(buf, sizeof(buf), "CPU %.0f%% miss %u", st.cpuLoad, (unsigned)st.totalMisses);
+        return String(buf);
+    };
+    items.push_back(std::move(summary));
+
+    for (int s = 0; s <= RenderProfiler::NUM_STAGES; ++s) {
+        auto item = MenuItem::Action("", [](TextGUI& gui) {});
+        item.dynamicTitle = [fresh, s]() {
+            const auto& st = fresh();
+            const auto& ss = (s < RenderProfiler::NUM_STAGES) ? st.stage[s] : st.busy;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%-6s%4.0f%5.0f%5.0f", labels[s], ss.meanUs, ss.p99Us, ss.maxUs);
+            return String(buf);
+        };
+        items.push_back(std::move(item));   // the MenuItem copy drops dynamicTitle
+    }
+#ifdef SILENCE_THRESHOLD_DB
+    auto silence = MenuItem::Action("", [](TextGUI& gui) {});
+    silence.dynamicTitle = []() {
+        FxReverb& rev = synth.getReverb();
+        const uint32_t blocks = rev.getBlocks();
+        char buf[32];
+        snprintf(buf, sizeof(buf), "quiet v%u rev%3.0f%%", (unsigned)synth.getVoicesRetired(),
+                 blocks ? 100.0f * rev.getSkippedBlocks() / blocks : 0.0f);
+        return String(buf);
+    };
+    items.push_back(std::move(silence));
+#endif
+    return items;
+}
+#endif
+
 inline std::vector<MenuItem> createSystemMenu() {
-    return {
+    std::vector<MenuItem> items = {
+        // file work is queued for the storage task, which reports back on the display
         MenuItem::Submenu("Save Drumkit", []() {
             std::vector<MenuItem> items;
-            auto kitNames = DrumkitStorage::listDrumkits(FS_USED, DRUMKIT_DIR);
-
-            for (const auto& name : kitNames) {
+            for (const auto& name : storage.kitNames()) {
                 items.emplace_back(MenuItem::Action(name, [name](TextGUI& gui) {
-                    char path[64];
-                    snprintf(path, sizeof(path), DRUMKIT_DIR "/%s.json", name.c_str());
-                    bool ok = DrumkitStorage::saveDrumkit(FS_USED, path, synth.getPatchMap(), synth.getReverb());
-                    gui.message(ok ? "Saved: " + name : "Save Failed");
+                    storage.post(StorageTask::SAVE_KIT, name);
                 }));
             }
 
             items.emplace_back(MenuItem::Action("New Drumkit", [](TextGUI& gui) {
-                String newName = DrumkitStorage::getNextDrumkitName(FS_USED, DRUMKIT_DIR);
-                char path[64];
-                snprintf(path, sizeof(path), DRUMKIT_DIR "/%s.json", newName.c_str());
-                bool ok = DrumkitStorage::saveDrumkit(FS_USED, path, synth.getPatchMap(), synth.getReverb());
-                gui.message(ok ? "Saved: " + newName : "Save Failed");
+                storage.post(StorageTask::NEW_KIT);
             }));
 
             return items;
@@ -306,46 +365,74 @@ inline std::vector<MenuItem> createSystemMenu() {
 
         MenuItem::Submenu("Load Drumkit", []() {
             std::vector<MenuItem> items;
-            auto kitNames = DrumkitStorage::listDrumkits(FS_USED, DRUMKIT_DIR);
+            for (const auto& name : storage.kitNames()) {
+                items.emplace_back(MenuItem::Action(name, [name](TextGUI& gui) {
+                    storage.post(StorageTask::LOAD_KIT, name);
+                }));
+            }
+
+            return items;
+        }),
 
-            for (const auto& name : kitNames) {
+        // the current kit as JSON, to edit or keep on the PC
+        MenuItem::Submenu("Export Drumkit", []() {
+            std::vector<MenuItem> items;
+            for (const auto& name : storage.kitNames()) {
                 items.emplace_back(MenuItem::Action(name, [name](TextGUI& gui) {
-                    char path[64];
-                    snprintf(path, sizeof(path), DRUMKIT_DIR "/%s.json", name.c_str());
-                    bool ok = DrumkitStorage::loadDrumkit(FS_USED, path, synth.getPatchMap(), synth.getReverb());
-                    gui.message(ok ? "Loaded: " + name : "Load Failed");
+                    storage.post(StorageTask::EXPORT_KIT, name);
                 }));
             }
 
             return items;
         })
     };
+#ifdef TASK_BENCHMARKING
+    items.push_back(MenuItem::Submenu("Render Profile", []() {
+        return createProfilerMenu();
+    }));
+#endif
+    return items;
 }
 
-static std::vector<MenuItem> createReverbMenu(FxReverb& reverb) {
+// The menu runs outside the audio task, so it reads the reverb's settings and hands
+// changed ones to the synth, which applies them between blocks.
+inline void setReverb(void (ReverbSettings::*set)(float), float v) {
+    ReverbSettings s = synth.getReverb().getSettings();
+    (s.*set)(v);
+    synth.setReverbSettings(s);
+}
+
+static std::vector<MenuItem> createReverbMenu() {
     using namespace std;
-    return {
+    std::vector<MenuItem> items = {
         MenuItem::Value("Size %",
-            [&] { return floatToIntRange(reverb.getTime(), 0, 100, 0.0f, 1.0f); },
-            [&](int v) { reverb.setTime(intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
+            [] { return floatToIntRange(synth.getReverb().getSettings().getTime(), 0, 100, 0.0f, 1.0f); },
+            [](int v) { setReverb(&ReverbSettings::setTime, intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
             0, 100, 1),
 
         MenuItem::Value("Level %",
-            [&] { return floatToIntRange(reverb.getLevel(), 0, 100, 0.0f, 1.0f); },
-            [&](int v) { reverb.setLevel(intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
+            [] { return floatToIntRange(synth.getReverb().getSettings().getLevel(), 0, 100, 0.0f, 1.0f); },
+            [](int v) { setReverb(&ReverbSettings::setLevel, intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
             0, 100, 1),
 
         MenuItem::Value("Damping %",
-            [&] { return floatToIntRange(reverb.getDamping(), 0, 100, 0.0f, 1.0f); },
-            [&](int v) { reverb.setDamping(intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
+            [] { return floatToIntRange(synth.getReverb().getSettings().getDamping(), 0, 100, 0.0f, 1.0f); },
+            [](int v) { setReverb(&ReverbSettings::setDamping, intToFloatRange(v, 0, 100, 0.0f, 1.0f)); },
             0, 100, 1),
 
         MenuItem::Value("PreDelay ms",
-            [&] { return floatToIntRange(reverb.getPreDelayTime() , 0 , 250 , 0.0f, 250.0f); },
-            [&](int v) { reverb.setPreDelayTime(intToFloatRange(v, 0, 250, 0.0f, 250.0f)); },
+            [] { return floatToIntRange(synth.getReverb().getSettings().getPreDelayTime() , 0 , 250 , 0.0f, 250.0f); },
+            [](int v) { setReverb(&ReverbSettings::setPreDelayTime, intToFloatRange(v, 0, 250, 0.0f, 250.0f)); },
             0, 250, 1)
 
     };
+#ifdef REVERB_PIPELINE
+    // on core 1, the wet signal comes DMA_BUFFER_LEN samples late
+    items.push_back(MenuItem::Toggle("Core1 +" + String(DMA_BUFFER_LEN) + "smp",
+        [] { return synth.isReverbPipelined() ? 1 : 0; },
+        [](int v) { synth.setReverbPipelined(v != 0); }));
+#endif
+    return items;
 }
 
 
@@ -356,7 +443,7 @@ inline std::vector<MenuItem> createRootMenu() {
             return createDrumkitEditor();
         }),
         MenuItem::Submenu("Edit Reverb", []() {
-            return createReverbMenu(synth.getReverb());  
+            return createReverbMenu();
         }),
         MenuItem::Submenu("System", []() {
             return createSystemMenu();
@@ -0,0 +1,156 @@
+/*
+* PackedPatch - an FmDrumPatch in 100 bytes instead of 196
+*
+* Every parameter an editor sets lies on the grid of its menu item: ratio in
+* hundredths, percentages in hundredths, times in whole milliseconds and so
+* on. PatchSteps holds those grids, and MenuStructure.h builds its editors
+* from them, so the two cannot drift apart. A value on its grid packs into a
+* 16-bit step number and comes back as exactly the same float.
+*
+* packPatch() is lossless or fails: it accepts a patch only if unpackPatch()
+* gives back every field bit for bit, so a kit imported from JSON with
+* values off the grid is stored as floats instead (see KitFormat.h). Step
+* numbers are not clamped to the menu range: a 20 kHz filter imported from
+* JSON packs as well.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+#include "FmPatch.h"
+
+// One editor grid: value = step / perUnit, steps minInt..maxInt in the menu.
+// Divided in double and rounded once to float, so step 8 of a 1/10 grid is
+// the float nearest to 0.8, the value a kit written by hand has, also where
+// -ffast-math turns the division into a multiplication by 1/perUnit.
+struct PatchStep {
+    int minInt, maxInt;
+    float perUnit;
+
+    float toFloat(long step) const { return (float)(step / (double)perUnit); }
+    double nearest(float f) const { return floor((double)f * perUnit + 0.5); }
+    // what an editor shows, within its range
+    int toInt(float f) const {
+        double v = nearest(f);
+        return v < minInt ? minInt : v > maxInt ? maxInt : int(v);
+    }
+};
+
+// the menu grids, see createPatchEditor() and createOpEditor()
+namespace PatchSteps {
+    static constexpr PatchStep Ratio      = { 0, 1000, 100.f };
+    static constexpr PatchStep Detune     = { -100, 100, 10.f };
+    static constexpr PatchStep Feedback   = { 0, 100, 10.f };
+    static constexpr PatchStep OpVolume   = { 0, 100, 100.f };
+    static constexpr PatchStep Volume     = { 0, 100, 50.f };       // 0..2
+    static constexpr PatchStep Pan        = { -100, 100, 100.f };
+    static constexpr PatchStep Percent    = { 0, 100, 100.f };      // sends, sustain, filter resonance and morph
+    static constexpr PatchStep Ms         = { 0, 8000, 1000.f };    // envelope times, stored in seconds
+    static constexpr PatchStep BaseFreq   = { 0, 10000, 1.f };
+    static constexpr PatchStep FilterFreq = { 0, 16000, 1.f };
+}
+
+struct PackedOp {
+    uint16_t ratio;
+    int16_t detune;
+    uint16_t feedback;
+    uint16_t volume;
+};
+
+struct PackedPatch {
+    char name[16];
+    uint8_t algoIndex;
+    uint8_t useFilter;
+    uint8_t chokeGroup;
+    uint8_t reserved;
+    uint16_t baseFreq;
+    uint16_t volume;
+    int16_t pan;
+    uint16_t reverbSend;
+    uint16_t velocityMod;
+    uint16_t attack, hold, decay, sustain, release;
+    uint16_t filterFreq;
+    uint16_t filterReso;
+    uint16_t filterMorph;
+    PackedOp ops[6];
+    uint8_t waveform[6];
+};
+static_assert(sizeof(PackedPatch) == 100, "PackedPatch is written as bytes");
+
+// the step of f on the grid, if f is exactly on it and the step fits T
+template<class T>
+inline bool packValue(const PatchStep& s, float f, T& out) {
+    if (!(f == f)) return false;    // NaN
+    const double near = s.nearest(f);
+    if (near < std::numeric_limits<T>::min() - 1.0 || near > std::numeric_limits<T>::max() + 1.0) return false;
+    for (long step = (long)near - 1; step <= (long)near + 1; ++step) {
+        if (step < std::numeric_limits<T>::min() || step > std::numeric_limits<T>::max()) continue;
+        const float v = s.toFloat(step);
+        if (memcmp(&v, &f, sizeof(f)) == 0) {  // -0.0f is not 0.0f
+            out = (T)step;
+            return true;
+        }
+    }
+    return false;
+}
+
+// false, leaving out partly written, if p has a value off its grid
+inline bool packPatch(const FmDrumPatch& p, PackedPatch& out) {
+    using namespace PatchSteps;
+    memset(&out, 0, sizeof(out));
+    memcpy(out.name, p.name, sizeof(out.name));
+    out.algoIndex = p.algoIndex;
+    out.useFilter = p.useFilter;
+    out.chokeGroup = p.chokeGroup;
+
+    bool ok = packValue(BaseFreq, p.baseFreq, out.baseFreq) && packValue(Volume, p.volume, out.volume) &&
+              packValue(Pan, p.pan, out.pan) && packValue(Percent, p.reverbSend, out.reverbSend) &&
+              packValue(Percent, p.velocityMod, out.velocityMod) &&
+              packValue(Ms, p.attack, out.attack) && packValue(Ms, p.hold, out.hold) &&
+              packValue(Ms, p.decay, out.decay) && packValue(Percent, p.sustain, out.sustain) &&
+              packValue(Ms, p.release, out.release) && packValue(FilterFreq, p.filterFreqHz, out.filterFreq) &&
+              packValue(Percent, p.filterReso, out.filterReso) && packValue(Percent, p.filterMorph, out.filterMorph);
+    for (int i = 0; i < 6 && ok; ++i) {
+        const FmOpParams& o = p.ops[i];
+        PackedOp& q = out.ops[i];
+        ok = packValue(Ratio, o.ratio, q.ratio) && packValue(Detune, o.detune, q.detune) &&
+             packValue(Feedback, o.feedback, q.feedback) && packValue(OpVolume, o.volume, q.volume);
+        out.waveform[i] = (uint8_t)o.waveform.value;
+    }
+    return ok;
+}
+
+inline void unpackPatch(const PackedPatch& q, FmDrumPatch& p) {
+    using namespace PatchSteps;
+    memcpy(p.name, q.name, sizeof(p.name));
+    p.algoIndex = q.algoIndex;
+    p.useFilter = q.useFilter;
+    p.chokeGroup = q.chokeGroup;
+    p.baseFreq = BaseFreq.toFloat(q.baseFreq);
+    p.volume = Volume.toFloat(q.volume);
+    p.pan = Pan.toFloat(q.pan);
+    p.reverbSend = Percent.toFloat(q.reverbSend);
+    p.velocityMod = Percent.toFloat(q.velocityMod);
+    p.attack = Ms.toFloat(q.attack);
+    p.hold = Ms.toFloat(q.hold);
+    p.decay = Ms.toFloat(q.decay);
+    p.sustain = Percent.toFloat(q.sustain);
+    p.release = Ms.toFloat(q.release);
+    p.filterFreqHz = FilterFreq.toFloat(q.filterFreq);
+    p.filterReso = Percent.toFloat(q.filterReso);
+    p.filterMorph = Percent.toFloat(q.filterMorph);
+    for (int i = 0; i < 6; ++i) {
+        FmOpParams& o = p.ops[i];
+        o.ratio = Ratio.toFloat(q.ops[i].ratio);
+        o.detune = Detune.toFloat(q.ops[i].detune);
+        o.feedback = Feedback.toFloat(q.ops[i].feedback);
+        o.volume = OpVolume.toFloat(q.ops[i].volume);
+        o.waveform = q.waveform[i] <= Waveform::NegSaw ? Waveform::Enum(q.waveform[i]) : Waveform::Sine;
+    }
+}
@@ -0,0 +1,223 @@
+/*
+* PatchPool - a kit's compiled patches, each distinct one stored once
+*
+* Note-on plays a patch compiled ahead of time (FmVoice6::compile()), 440
+* bytes each, 55 kB for all 128 notes of a kit. But a kit is mostly a handful
+* of patches spread over the keyboard: the default one has 59 different ones.
+* So the pool keeps one compiled patch per distinct sound plus a 128-byte
+* index from note to slot.
+*
+* The slots are in PSRAM, next to the patch maps: only the index is internal
+* RAM, 128 bytes per kit where the patch map used to take 25 kB. Note-on
+* copies its 440 bytes out of PSRAM once, a few microseconds; the voices it
+* renders into stay internal.
+*
+* build() fills it from a whole patch map when a kit is loaded, and sizes it
+* to what that kit needs: one slot per distinct patch plus PATCH_POOL_SPARE
+* free ones for edits. The pool only grows, so loading kits back and forth
+* does not churn the heap, and every note of a kit gets its slot. Each slot
+* keeps a copy of the patch it was compiled from (only compared by the
+* editing task), so editing a note (update()) first checks whether
+* anything note-on plays has changed at all: a name or a menu action that
+* left the patch alone costs nothing. A changed patch moves to a slot that
+* already plays the same sound, or else is compiled into a free slot and the
+* note's index is moved to it once it is written. Never into the slot the note
+* plays, even one it does not share: a note-on may be copying that one at the
+* same time, and would start the voice half old, half new. For the same
+* reason a slot no note refers to any more is only free again once the audio
+* task has started another block: a note-on of the block it was let go in may
+* have read the note's old index just before it moved. Until then the slot is
+* still intact, and an edit back to the sound it has takes it up again, as
+* turning an encoder to and fro does.
+*
+* When the spare slots are used up, update() returns FULL and the note keeps
+* playing the slot it had until the pool is built again: FmDrumSynth then asks
+* for a repack (repackKit()), which the storage task does off the audio path,
+* and that build sizes the pool for the edited kit.
+*
+* The audio task only reads forNote(); everything else runs in one GUI or
+* loader task at a time, as patchChanged() and commitKit() do.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include "config.h"
+#include "platform.h"
+#include "FmVoice6.h"
+#include "FmPatch.h"
+#include <atomic>
+
+class PatchPool {
+public:
+    static constexpr uint8_t NotPooled = 0xFF;
+    static constexpr int MaxSlots = 128 + PATCH_POOL_SPARE;    // one per note at most, and the spares
+    static_assert(MaxSlots < NotPooled, "slot numbers are bytes");
+
+    PatchPool() {
+        for (int n = 0; n < 128; ++n) index_[n].store(NotPooled, std::memory_order_relaxed);
+    }
+
+    // --- audio task ---
+
+    // the compiled patch of a note; nullptr only before the first build(), or when
+    // the pool could not get the memory for its kit. Sequentially consistent with the
+    // block counter, see update().
+    inline const FmVoicePatch* forNote(uint8_t note) const {
+        uint8_t s = index_[note & 127].load();
+        return s == NotPooled ? nullptr : &slots_[s].compiled;
+    }
+
+    // --- GUI / loader task ---
+
+    // compiles a whole patch map, notes with the same sound sharing one slot;
+    // only for a kit the audio task is not playing
+    void build(const FmDrumPatch* patchMap) {
+        uint8_t first[128];     // the lowest note with the same patch
+        int distinct = 0;
+        for (int n = 0; n < 128; ++n) {
+            int m = 0;
+            while (m < n && (first[m] != m || !samePatch(patchMap[m], patchMap[n]))) ++m;
+            first[n] = m;
+            if (m == n) ++distinct;
+        }
+        reserve(distinct + PATCH_POOL_SPARE);
+
+        int used = 0, unpooled = 0;
+        for (int s = 0; s < capacity_; ++s) {
+            slots_[s].refs = 0;
+            slots_[s].retiring = false;
+        }
+        for (int n = 0; n < 128; ++n) {
+            uint8_t s = NotPooled;
+            if (first[n] != n) {
+                s = index_[first[n]].load(std::memory_order_relaxed);
+            } else if (used < capacity_) {
+                s = used++;
+                slots_[s].key = patchMap[n];
+                slots_[s].compiled = FmVoice6::compile(patchMap[n]);
+            }
+            if (s != NotPooled) ++slots_[s].refs;
+            else                ++unpooled;
+            index_[n].store(s, std::memory_order_release);
+        }
+        full_ = false;
+        if (unpooled) ESP_LOGE("PatchPool", "No memory for %d distinct patches, %d notes are silent", distinct, unpooled);
+        else          ESP_LOGI("PatchPool", "%d distinct patches in %d slots", used, capacity_);
+    }
+
+    enum Result : uint8_t {
+        DONE,       // the note plays its patch as it is now
+        WAIT,       // the free slots were all let go of in this block: again after the next one
+        FULL        // no free slot, the note keeps its old sound
+    };
+
+    // The note's patch may have been edited: points the note at a slot that plays it.
+    // blocks is the audio task's block counter (FmDrumSynth), advanced at the start of
+    // every block before its note-ons.
+    Result update(const FmDrumPatch* patchMap, uint8_t note, const std::atomic<uint32_t>& blocks) {
+        note &= 127;
+        const FmDrumPatch& patch = patchMap[note];
+        const uint8_t s = index_[note].load(std::memory_order_relaxed);
+        if (s != NotPooled && samePatch(slots_[s].key, patch)) return DONE;     // nothing note-on plays
+
+        const uint32_t now = blocks.load();
+        bool waiting = false;
+        for (int t = 0; t < capacity_; ++t) {
+            Slot& slot = slots_[t];
+            if (slot.retiring && slot.freedAt != now) slot.retiring = false;   // its block is over
+            waiting |= slot.retiring;
+        }
+
+        for (int t = 0; t < capacity_; ++t) {       // another note has this sound already, or had it lately
+            if (t == s || (slots_[t].refs == 0 && !slots_[t].retiring) || !samePatch(slots_[t].key, patch)) continue;
+            slots_[t].retiring = false;
+            ++slots_[t].refs;
+            moveNote(note, t, blocks);
+            return DONE;
+        }
+
+        int free = 0;
+        while (free < capacity_ && (slots_[free].refs > 0 || slots_[free].retiring)) ++free;
+        if (free == capacity_) {
+            if (waiting) return WAIT;
+            if (!full_) ESP_LOGW("PatchPool", "Full, note %d keeps its sound until the pool is built again", note);
+            full_ = true;
+            return FULL;
+        }
+        slots_[free].key = patch;
+        slots_[free].compiled = FmVoice6::compile(patch);
+        slots_[free].refs = 1;
+        moveNote(note, free, blocks);               // after the slot is written
+        return DONE;
+    }
+
+    int numUsed() const {
+        int k = 0;
+        for (int s = 0; s < capacity_; ++s) k += slots_[s].refs > 0 ? 1 : 0;
+        return k;
+    }
+
+    inline int capacity() const { return capacity_; }
+
+    // everything compile() reads, that is all but the name
+    static bool samePatch(const FmDrumPatch& a, const FmDrumPatch& b) {
+        if (a.algoIndex != b.algoIndex || a.baseFreq != b.baseFreq || a.volume != b.volume || a.pan != b.pan ||
+            a.reverbSend != b.reverbSend || a.velocityMod != b.velocityMod || a.chokeGroup != b.chokeGroup) return false;
+        if (a.attack != b.attack || a.hold != b.hold || a.decay != b.decay || a.sustain != b.sustain ||
+            a.release != b.release) return false;
+        if (a.useFilter != b.useFilter || a.filterFreqHz != b.filterFreqHz || a.filterReso != b.filterReso ||
+            a.filterMorph != b.filterMorph) return false;
+        for (int i = 0; i < 6; ++i) {
+            const FmOpParams& x = a.ops[i];
+            const FmOpParams& y = b.ops[i];
+            if (x.ratio != y.ratio || x.detune != y.detune || x.feedback != y.feedback ||
+                x.volume != y.volume || x.waveform != y.waveform) return false;
+        }
+        return true;
+    }
+
+private:
+    struct Slot {
+        FmVoicePatch compiled;      // what note-on copies
+        FmDrumPatch key;            // what it was compiled from
+        uint8_t refs;               // notes playing it, 0 = free
+        bool retiring;              // no notes since block freedAt, not free before the next one
+        uint32_t freedAt;
+    };
+
+    // Points note at slot to, which is written, and lets go of the one it had. The
+    // store and the counter load are sequentially consistent, as are the audio task's
+    // counter store and its forNote(): a note-on that still read the old index belongs
+    // to a block the counter has already reached here, freedAt or an earlier one.
+    void moveNote(uint8_t note, uint8_t to, const std::atomic<uint32_t>& blocks) {
+        const uint8_t from = index_[note].load(std::memory_order_relaxed);
+        index_[note].store(to);
+        if (from == NotPooled || --slots_[from].refs > 0) return;
+        slots_[from].retiring = true;
+        slots_[from].freedAt = blocks.load();
+    }
+
+    // room for n slots, in PSRAM unless there is none; only for a kit the audio task
+    // is not playing. Keeps the slots it has if it cannot get more.
+    void reserve(int n) {
+        if (n > MaxSlots) n = MaxSlots;
+        if (n <= capacity_) return;
+        Slot* s = (Slot*) heap_caps_malloc(n * sizeof(Slot), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!s) s = (Slot*) heap_caps_malloc(n * sizeof(Slot), MALLOC_CAP_8BIT);
+        if (!s) {
+            ESP_LOGE("PatchPool", "Failed to allocate %d patches", n);
+            return;
+        }
+        heap_caps_free(slots_);
+        slots_ = s;
+        capacity_ = n;
+    }
+
+    Slot* slots_ = nullptr;             // PSRAM
+    int capacity_ = 0;
+    std::atomic<uint8_t> index_[128];   // note -> slot or NotPooled
+    bool full_ = false;
+};
@@ -0,0 +1,191 @@
+/*
+* RenderProfiler - per-stage cost of the audio task
+*
+* The audio task stamps the CPU cycle counter at the end of every stage of a
+* block (voices, mix, reverb, output conversion, I2S wait); each block becomes
+* one record in a ring. The ring has a single writer and is read without locks
+* by the GUI page and the serial dump, which turn the last few hundred blocks
+* into min/mean/p99/max per stage, CPU load and deadline misses.
+*
+* Only exists with TASK_BENCHMARKING defined in config.h; otherwise the
+* PROFILE_STAGE() hooks expand to nothing and no code or data is left.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include "config.h"
+
+#ifdef TASK_BENCHMARKING
+
+#include "platform.h"
+#include <stdio.h>
+#include <atomic>
+#include <algorithm>
+
+class RenderProfiler {
+public:
+    enum Stage : uint8_t { VOICES, MIX, REVERB, OUTPUT, I2S_WAIT, NUM_STAGES };
+
+    static constexpr uint32_t RING_SIZE = 256;            // power of two, ~370 ms of 64-sample blocks
+    static constexpr uint32_t WINDOW    = RING_SIZE - 16;  // blocks per snapshot, the rest is slack for the writer
+
+    struct StageStats {
+        float minUs, meanUs, p99Us, maxUs;
+    };
+
+    struct Stats {
+        StageStats stage[NUM_STAGES];
+        StageStats busy;          // everything but the I2S wait
+        float cpuLoad;            // busy share of the wall time, %
+        float deadlineUs;         // one block of audio
+        uint32_t blocks;          // records in the window
+        uint32_t windowMisses;    // blocks in the window whose busy time exceeded the deadline
+        uint32_t totalMisses;     // since boot or reset()
+        uint32_t totalBlocks;
+    };
+
+    using PrintFn = void (*)(const char*);
+
+    static const char* stageName(int s) {
+        static const char* names[NUM_STAGES] = { "voices", "mix", "reverb", "output", "i2s wait" };
+        return (s >= 0 && s < NUM_STAGES) ? names[s] : "?";
+    }
+
+    // --- audio task ---
+
+    // end of stage s; the I2S wait closes the block
+    inline void mark(Stage s) {
+        uint32_t now = ESP.getCycleCount();
+        cur_.cycles[s] = now - last_;
+        last_ = now;
+        if (s == I2S_WAIT) commit();
+    }
+
+    // --- any other task ---
+
+    // false if the writer lapped the reader meanwhile; just try again later
+    bool snapshot(Stats& st) const {
+        const uint32_t end = written_.load(std::memory_order_acquire);
+        uint32_t n = end - resetAt_.load(std::memory_order_relaxed);
+        if (n > WINDOW) n = WINDOW;
+        const uint32_t start = end - n;
+
+        memset(&st, 0, sizeof(st));
+        st.deadlineUs = (float)DMA_BUFFER_LEN * 1.0e6f / (float)SAMPLE_RATE;
+        st.blocks = n;
+        st.totalBlocks = end - resetAt_.load(std::memory_order_relaxed);
+        st.totalMisses = misses_.load(std::memory_order_relaxed) - missesAtReset_.load(std::memory_order_relaxed);
+        if (n == 0) return true;
+
+        const float usPerCycle = 1.0f / (float)getCpuFrequencyMhz();
+        uint32_t values[WINDOW];
+        uint64_t busySum = 0, wallSum = 0;
+
+        for (int s = 0; s <= NUM_STAGES; ++s) {    // s == NUM_STAGES: busy
+            for (uint32_t i = 0; i < n; ++i) {
+                const Record& r = ring_[(start + i) & (RING_SIZE - 1)];
+                values[i] = (s < NUM_STAGES) ? r.cycles[s] : busyCycles(r);
+                if (s == NUM_STAGES) {
+                    busySum += values[i];
+                    wallSum += values[i] + r.cycles[I2S_WAIT];
+                    if (values[i] > deadlineCycles()) ++st.windowMisses;
+                }
+            }
+            (s < NUM_STAGES ? st.stage[s] : st.busy) = summarize(values, n, usPerCycle);
+        }
+        st.cpuLoad = wallSum ? 100.0f * (float)busySum / (float)wallSum : 0.0f;
+
+        return written_.load(std::memory_order_acquire) - start <= RING_SIZE;
+    }
+
+    // restarts the totals; the window refills from the next block on
+    void reset() {
+        missesAtReset_.store(misses_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        resetAt_.store(written_.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+
+    void print(PrintFn print) const {
+        Stats st;
+        if (!snapshot(st)) return;
+        char line[96];
+        snprintf(line, sizeof(line), "Render profile: %u blocks, deadline %.0f us, CPU load %.1f %%\n",
+                 (unsigned)st.blocks, st.deadlineUs, st.cpuLoad);
+        print(line);
+        print("stage        min    mean     p99     max  us\n");
+        for (int s = 0; s <= NUM_STAGES; ++s) {
+            const StageStats& ss = (s < NUM_STAGES) ? st.stage[s] : st.busy;
+            snprintf(line, sizeof(line), "%-9s %7.1f %7.1f %7.1f %7.1f\n",
+                     s < NUM_STAGES ? stageName(s) : "busy", ss.minUs, ss.meanUs, ss.p99Us, ss.maxUs);
+            print(line);
+        }
+        snprintf(line, sizeof(line), "deadline misses: %u in window, %u of %u blocks total\n",
+                 (unsigned)st.windowMisses, (unsigned)st.totalMisses, (unsigned)st.totalBlocks);
+        print(line);
+    }
+
+private:
+    struct Record {
+        uint32_t cycles[NUM_STAGES];
+    };
+
+    static inline uint32_t busyCycles(const Record& r) {
+        uint32_t sum = 0;
+        for (int s = 0; s < I2S_WAIT; ++s) sum += r.cycles[s];
+        return sum;
+    }
+
+    static inline uint32_t deadlineCycles() {
+        return (uint32_t)((uint64_t)getCpuFrequencyMhz() * 1000000ULL * DMA_BUFFER_LEN / SAMPLE_RATE);
+    }
+
+    static StageStats summarize(uint32_t* v, uint32_t n, float usPerCycle) {
+        uint64_t sum = 0;
+        uint32_t lo = v[0], hi = v[0];
+        for (uint32_t i = 0; i < n; ++i) {
+            sum += v[i];
+            lo = std::min(lo, v[i]);
+            hi = std::max(hi, v[i]);
+        }
+        uint32_t k = (n * 99) / 100;
+        if (k >= n) k = n - 1;
+        std::nth_element(v, v + k, v + n);
+        return { lo * usPerCycle, (float)sum / (float)n * usPerCycle, v[k] * usPerCycle, hi * usPerCycle };
+    }
+
+    void commit() {
+        if (!primed_) {         // the first record would start at cycle 0
+            primed_ = true;
+            return;
+        }
+        const uint32_t w = written_.load(std::memory_order_relaxed);
+        ring_[w & (RING_SIZE - 1)] = cur_;
+        if (busyCycles(cur_) > deadlineCycles()) misses_.fetch_add(1, std::memory_order_relaxed);
+        written_.store(w + 1, std::memory_order_release);
+    }
+
+    // audio task only
+    Record cur_ = {};
+    uint32_t last_ = 0;
+    bool primed_ = false;
+
+    Record ring_[RING_SIZE] = {};
+    std::atomic<uint32_t> written_{0};
+    std::atomic<uint32_t> misses_{0};
+
+    // reader side
+    std::atomic<uint32_t> resetAt_{0};
+    std::atomic<uint32_t> missesAtReset_{0};
+};
+
+inline RenderProfiler renderProfiler;
+
+#define PROFILE_STAGE(stage) renderProfiler.mark(RenderProfiler::stage)
+
+#else
+
+#define PROFILE_STAGE(stage) do {} while (0)
+
+#endif
@@ -0,0 +1,242 @@
+/*
+* SampleCache - the kit's one-shot patches pre-rendered to PSRAM
+*
+* A patch without sustain always makes the same sound after a note-on: the
+* operators start from phase 0, nothing in the voice depends on velocity
+* except the output gain, and there is no noise source. So refresh() renders
+* each such patch once, through a voice of its own, into a peak-normalised
+* 16-bit sample, and note-on plays that back (FmVoice6::playCached()) for a
+* few cycles per sample instead of six operators.
+*
+* Notes with the same sound share one sample: pan, reverb send, volume and
+* choke group are applied at playback or in the mix, so they are not part of
+* the render. A patch that is still ringing after SAMPLE_CACHE_MAX_MS stays
+* on FM, as does one that is being edited: patchChanged() drops the note's
+* sample and refresh() makes a new one once the editor is left. A cached voice
+* costs 1 of VOICE_COST_BUDGET (FmVoice6::rendererCost()).
+*
+* refresh() runs in the GUI / loader task while the audio task keeps playing.
+* Samples no note refers to any more are freed on a later refresh(), once no
+* voice plays them (CachedSample::users).
+*
+* Only exists with SAMPLE_CACHE defined in config.h.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include "config.h"
+
+#ifdef SAMPLE_CACHE
+
+#include "platform.h"
+#include "FmVoice6.h"
+#include "FmPatch.h"
+#include "dsp_kernels.h"
+#include <atomic>
+#include <new>
+
+class SampleCache {
+public:
+    static constexpr int MaxSamples = 128;
+    static constexpr uint32_t MaxLength = (uint32_t)((uint64_t)SAMPLE_CACHE_MAX_MS * SAMPLE_RATE / 1000);
+
+    // --- audio task ---
+
+    // the sample to play for a note-on, nullptr to run the operators
+    inline CachedSample* forNote(uint8_t note) const {
+        return notes_[note & 127].load(std::memory_order_acquire);
+    }
+
+    // --- GUI / loader task ---
+
+    // the note's patch has been edited: it plays FM until the next refresh()
+    void invalidate(uint8_t note) {
+        notes_[note & 127].store(nullptr, std::memory_order_release);
+    }
+
+    // Renders what patchMap[] needs and is not cached yet, frees what is no longer
+    // needed. Returns the number of patches rendered.
+    int refresh(const FmDrumPatch* patchMap) {
+        if (!slots_ && !init()) return 0;
+
+        float* scratch = (float*) heap_caps_malloc(MaxLength * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!scratch) {
+            ESP_LOGE("SampleCache", "No memory for the render buffer");
+            return 0;
+        }
+
+        int rendered = 0;
+        for (int n = 0; n < 128; ++n) {
+            if (notes_[n].load(std::memory_order_relaxed)) continue;
+            const FmDrumPatch& p = patchMap[n];
+            if (!isOneShot(p)) continue;
+            Slot* s = find(p);
+            if (!s) {
+                s = render(p, scratch);
+                if (!s) continue;
+                ++rendered;
+            }
+            s->retired = false;
+            if (s->sample.data) notes_[n].store(&s->sample, std::memory_order_release);
+        }
+        heap_caps_free(scratch);
+
+        collect(patchMap);
+        ESP_LOGI("SampleCache", "%d patches rendered, %d samples, %u kB", rendered, numSamples(), (unsigned)(bytes_ / 1024));
+        return rendered;
+    }
+
+    int numSamples() const {
+        int k = 0;
+        for (int i = 0; slots_ && i < MaxSamples; ++i) k += (slots_[i].used && slots_[i].sample.data) ? 1 : 0;
+        return k;
+    }
+
+    inline size_t bytes() const { return bytes_; }
+
+    // only what the render depends on: see the header comment
+    static bool sameSound(const FmDrumPatch& a, const FmDrumPatch& b) {
+        if (a.algoIndex != b.algoIndex || a.baseFreq != b.baseFreq || a.useFilter != b.useFilter) return false;
+        if (a.attack != b.attack || a.hold != b.hold || a.decay != b.decay || a.sustain != b.sustain) return false;
+        if (a.useFilter && (a.filterFreqHz != b.filterFreqHz || a.filterReso != b.filterReso || a.filterMorph != b.filterMorph)) return false;
+        for (int i = 0; i < 6; ++i) {
+            const FmOpParams& x = a.ops[i];
+            const FmOpParams& y = b.ops[i];
+            if (x.ratio != y.ratio || x.detune != y.detune || x.feedback != y.feedback ||
+                x.volume != y.volume || x.waveform != y.waveform) return false;
+        }
+        return true;
+    }
+
+    static inline bool isOneShot(const FmDrumPatch& p) { return p.sustain <= 0.0f; }
+
+private:
+    struct Slot {
+        FmDrumPatch key;
+        CachedSample sample;    // data == nullptr: renders longer than MaxLength, plays FM
+        bool used = false;
+        bool retired = false;   // no note refers to it since the last refresh()
+    };
+
+    Slot* slots_ = nullptr;     // PSRAM, the audio task only reads the samples
+    FmVoice6* voice_ = nullptr; // the renderer, on an operator bank slot of its own
+    std::atomic<CachedSample*> notes_[128] = {};
+    size_t bytes_ = 0;
+
+    bool init() {
+        slots_ = (Slot*) heap_caps_malloc(MaxSamples * sizeof(Slot), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!slots_) {
+            ESP_LOGE("SampleCache", "Failed to allocate the sample table");
+            return false;
+        }
+        for (int i = 0; i < MaxSamples; ++i) new (&slots_[i]) Slot();
+        voice_ = new FmVoice6();
+        return true;
+    }
+
+    Slot* find(const FmDrumPatch& p) {
+        for (int i = 0; i < MaxSamples; ++i) {
+            if (slots_[i].used && sameSound(slots_[i].key, p)) return &slots_[i];
+        }
+        return nullptr;
+    }
+
+    Slot* freeSlot() {
+        for (int i = 0; i < MaxSamples; ++i) {
+            if (!slots_[i].used) return &slots_[i];
+        }
+        return nullptr;
+    }
+
+    // note-on at volume and velocity 1, until the voice ends or falls silent
+    Slot* render(const FmDrumPatch& p, float* scratch) {
+        Slot* s = freeSlot();
+        if (!s) return nullptr;
+
+        FmDrumPatch q = p;
+        q.volume = 1.0f;
+        FmVoice6& v = *voice_;
+        v.reset();
+        v.applyPatch(q);
+        v.noteOn(0, 1.0f);
+
+        uint32_t len = 0;
+        float peak = 0.0f;
+#ifdef SILENCE_THRESHOLD_DB
+        const float silenceLevel = powf(10.0f, SILENCE_THRESHOLD_DB * 0.05f);
+#endif
+        while (v.isActive() && len + DMA_BUFFER_LEN <= MaxLength) {
+            v.process();
+            const float blockPeak = DspKernels::peak(v.getBlockBuffer(), DMA_BUFFER_LEN);
+#ifdef SILENCE_THRESHOLD_DB
+            if (v.trackSilence(blockPeak < silenceLevel)) v.retire();
+#endif
+            memcpy(scratch + len, v.getBlockBuffer(), DMA_BUFFER_LEN * sizeof(float));
+            len += DMA_BUFFER_LEN;
+            if (blockPeak > peak) peak = blockPeak;
+        }
+
+        s->key = p;
+        s->used = true;
+        s->retired = false;
+        s->sample.users.store(0, std::memory_order_relaxed);
+        s->sample.data = nullptr;
+        s->sample.length = 0;
+        if (v.isActive()) {
+            v.retire();
+            ESP_LOGI("SampleCache", "'%s' rings longer than %d ms, stays on FM", p.name, SAMPLE_CACHE_MAX_MS);
+            return s;
+        }
+        if (bytes_ + len * sizeof(int16_t) > (size_t)SAMPLE_CACHE_KB * 1024) {
+            s->used = false;
+            ESP_LOGW("SampleCache", "Budget of %d kB used up, '%s' stays on FM", SAMPLE_CACHE_KB, p.name);
+            return nullptr;
+        }
+        int16_t* data = (int16_t*) heap_caps_malloc(len * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!data) {
+            s->used = false;
+            ESP_LOGE("SampleCache", "Failed to allocate %u samples for '%s'", (unsigned)len, p.name);
+            return nullptr;
+        }
+        const float toInt = (peak > 0.0f) ? 32767.0f / peak : 0.0f;
+        for (uint32_t i = 0; i < len; ++i) data[i] = (int16_t)lrintf(scratch[i] * toInt);
+        s->sample.data = data;
+        s->sample.length = len;
+        s->sample.scale = (peak > 0.0f) ? peak / 32767.0f : 0.0f;
+        bytes_ += len * sizeof(int16_t);
+        return s;
+    }
+
+    // Slots no note refers to are retired; a slot that already was on the previous
+    // refresh() and has no voice playing it is freed. The gap between two refreshes
+    // covers a note-on that fetched the pointer just before invalidate().
+    void collect(const FmDrumPatch* patchMap) {
+        for (int i = 0; i < MaxSamples; ++i) {
+            Slot& s = slots_[i];
+            if (!s.used) continue;
+            bool needed = false;
+            for (int n = 0; n < 128 && !needed; ++n) {
+                needed = (notes_[n].load(std::memory_order_relaxed) == &s.sample) ||
+                         (!s.sample.data && sameSound(s.key, patchMap[n]));
+            }
+            if (needed) continue;
+            if (!s.retired) {
+                s.retired = true;
+            } else if (s.sample.users.load(std::memory_order_acquire) == 0) {
+                if (s.sample.data) {
+                    heap_caps_free((void*)s.sample.data);
+                    bytes_ -= s.sample.length * sizeof(int16_t);
+                }
+                s.sample.data = nullptr;
+                s.sample.length = 0;
+                s.used = false;
+                s.retired = false;
+            }
+        }
+    }
+};
+
+#endif // SAMPLE_CACHE
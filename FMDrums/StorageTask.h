@@ -0,0 +1,315 @@
+/*
+* StorageTask - kit files are read and written here, not on the MIDI task
+*
+* The menu actions used to save and load kits right where the encoder is
+* read, in midiTask, so MIDI input stopped for as long as the SD card took.
+* Now they only post() a request: a low-priority task works through the
+* queue, and MIDI, GUI and audio preempt it whenever they have work. Kits are
+* written a few patches at a time (DrumkitStorage::Progress); progress and
+* the result go to the display through the report function given to begin().
+*
+* The names of the kits on the card are listed here as well and kept for the
+* menus, so opening a kit menu does not read the directory either.
+*
+* Autosave (AUTOSAVE_MS): when the queue has been empty that long, the patches
+* edited since the last look (FmDrumSynth::takeEditedNotes()) and a changed
+* reverb are appended to the journal of the current kit, once no further edits
+* came in for a whole interval. That writes a few hundred bytes per edited
+* patch instead of the whole kit; when the journal reaches
+* JOURNAL_COMPACT_RECORDS records, the kit file is rewritten from memory and
+* the journal deleted (DrumkitStorage::writeDrumkit()). Loading a kit replays
+* its journal; the first idle moment after that folds it into the kit file.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include "config.h"
+#include "FmDrumSynth.h"
+#include "DrumkitStorage.h"
+#include "KitFormat.h"
+
+class StorageTask {
+public:
+    enum Op : uint8_t {
+        LIST_KITS,      // re-read the kit names
+        SAVE_KIT,       // the current kit as <name>.fmk
+        NEW_KIT,        // the same under the next free "DrumkitN" name
+        LOAD_KIT,       // <name>, switched to at a block boundary, see FmDrumSynth::beginKit()
+        EXPORT_KIT,     // the current kit as <name>.json
+        EXPORT_PRESET,  // one patch to PRESET_DIR as <patch name>.json
+        REFRESH_SAMPLES,// render what the sample cache is missing
+        REPACK_KIT      // build the compiled patches of the kit afresh, see FmDrumSynth::repackKit()
+    };
+
+    using ReportFn = void (*)(const char* text);
+
+    void begin(fs::FS& fs, FmDrumSynth& synth, ReportFn report, UBaseType_t priority, BaseType_t core) {
+        fs_ = &fs;
+        synth_ = &synth;
+        report_ = report;
+        queue_ = xQueueCreate(QueueLength, sizeof(Request));
+        namesLock_ = xSemaphoreCreateMutex();
+        xTaskCreatePinnedToCore(taskFn, "storage", 8192, this, priority, &task_, core);
+        post(LIST_KITS);
+    }
+
+    // the kit loaded before begin(), so that its edits are journaled; generation as
+    // DrumkitStorage::loadDrumkitByName() gave it
+    void setKit(const String& name, const ReverbSettings& reverb, uint32_t generation) {
+        useKit(name, reverb, generation);
+    }
+
+    // any task, never waits: false if the queue is full
+    bool post(Op op, const String& name = String(), const FmDrumPatch* patch = nullptr) {
+        if (!queue_) return false;
+        Request r = {};
+        r.op = op;
+        strlcpy(r.name, name.c_str(), sizeof(r.name));
+        if (patch) r.patch = *patch;
+        if (xQueueSend(queue_, &r, 0) != pdTRUE) {
+            report("Storage busy");
+            return false;
+        }
+        return true;
+    }
+
+    // the kit names as of the last LIST_KITS (also done after every save)
+    std::vector<String> kitNames() {
+        std::vector<String> names;
+        if (namesLock_ && xSemaphoreTake(namesLock_, portMAX_DELAY) == pdTRUE) {
+            names = names_;
+            xSemaphoreGive(namesLock_);
+        }
+        return names;
+    }
+
+    inline bool busy() const { return busy_; }
+
+private:
+    static constexpr int QueueLength = 8;
+
+    struct Request {
+        Op op;
+        char name[32];
+        FmDrumPatch patch;  // EXPORT_PRESET: a copy taken when it was posted
+    };
+
+    fs::FS* fs_ = nullptr;
+    FmDrumSynth* synth_ = nullptr;
+    ReportFn report_ = nullptr;
+    QueueHandle_t queue_ = nullptr;
+    SemaphoreHandle_t namesLock_ = nullptr;
+    TaskHandle_t task_ = nullptr;
+    std::vector<String> names_;
+    volatile bool busy_ = false;
+
+    // autosave, this task only
+    String kit_;                    // the kit edits are journaled for; none before a load or save
+    uint32_t generation_ = 0;       // of its kit file, see KitFormat::JournalHeader
+    uint32_t pending_[4] = {};      // edited notes not journaled yet
+    ReverbSettings journaledReverb_;    // the reverb as the kit file plus journal have it
+    ReverbSettings tickReverb_;         // as it was at the last idle tick
+    int journalRecords_ = 0;
+    bool foldJournal_ = false;      // a kit was loaded: fold its replayed journal in when idle
+    bool autosaveFailed_ = false;
+
+    static void taskFn(void* self) {
+        StorageTask& st = *static_cast<StorageTask*>(self);
+#ifdef AUTOSAVE_MS
+        const TickType_t wait = pdMS_TO_TICKS(AUTOSAVE_MS);
+#else
+        const TickType_t wait = portMAX_DELAY;
+#endif
+        Request r;
+        while (true) {
+            if (xQueueReceive(st.queue_, &r, wait) != pdTRUE) {
+                st.idle();
+                continue;
+            }
+            st.busy_ = true;
+            st.handle(r);
+            st.busy_ = false;
+        }
+    }
+
+    void report(const char* text) {
+        if (report_) report_(text);
+        else ESP_LOGI("Storage", "%s", text);
+    }
+
+    void report(const String& text) { report(text.c_str()); }
+
+    // "Saved: Drumkit3" or "Save Failed"
+    void result(bool ok, const char* done, const char* failed, const String& name) {
+        char buf[48];
+        if (ok) snprintf(buf, sizeof(buf), "%s: %s", done, name.c_str());
+        else    snprintf(buf, sizeof(buf), "%s Failed", failed);
+        report(buf);
+    }
+
+    // "<what> 25%" every quarter of the kit
+    DrumkitStorage::Progress progress(const char* what) {
+        return [this, what, quarter = 0](int done) mutable {
+            if (done / 32 == quarter || done >= 128) return;
+            quarter = done / 32;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%s %d%%", what, quarter * 25);
+            report(buf);
+        };
+    }
+
+    void handle(const Request& r) {
+        const String name(r.name);
+        switch (r.op) {
+            case LIST_KITS:
+                listKits();
+                break;
+
+            case SAVE_KIT:
+            case NEW_KIT: {
+                const String kit = (r.op == NEW_KIT) ? DrumkitStorage::getNextDrumkitName(*fs_, DRUMKIT_DIR) : name;
+                takeEdits();
+                if (kit != kit_) flush();   // the kit saved from keeps its edits
+                const ReverbSettings reverb = synth_->getReverb().getSettings();
+                uint32_t generation = 0;
+                bool ok = DrumkitStorage::writeDrumkit(*fs_, DRUMKIT_DIR, kit, synth_->getPatchMap(), reverb,
+                                                       progress("Saving"), &generation);
+                result(ok, "Saved", "Save", kit);
+                if (ok) {
+                    useKit(kit, reverb, generation);
+                    foldJournal_ = false;
+                    listKits();
+                }
+                break;
+            }
+
+            case LOAD_KIT: {
+                report("Loading " + name);
+                takeEdits();
+                flush();                    // before the kit they belong to is replaced
+                DrumKit& kit = synth_->beginKit();
+                uint32_t generation = 0;
+                bool ok = DrumkitStorage::loadDrumkitByName(*fs_, DRUMKIT_DIR, name, kit.patches, kit.reverb, &generation);
+                if (ok) {
+                    synth_->commitKit(kit);
+                    useKit(name, kit.reverb, generation);
+                }
+                result(ok, "Loaded", "Load", name);
+                break;
+            }
+
+            case EXPORT_KIT: {
+                const String path = DrumkitStorage::drumkitPath(DRUMKIT_DIR, name, ".json");
+                bool ok = DrumkitStorage::saveDrumkitJson(*fs_, path.c_str(), synth_->getPatchMap(),
+                                                          synth_->getReverb().getSettings(), progress("Exporting"));
+                result(ok, "Exported", "Export", name);
+                if (ok) listKits();
+                break;
+            }
+
+            case EXPORT_PRESET: {
+                const String preset = r.patch.name[0] ? String(r.patch.name) : String("preset");
+                const String path = DrumkitStorage::drumkitPath(PRESET_DIR, preset, ".json");
+                bool ok = DrumkitStorage::saveSinglePatch(*fs_, path.c_str(), r.patch);
+                result(ok, "Exported", "Export", preset);
+                break;
+            }
+
+            case REFRESH_SAMPLES:
+                synth_->refreshSampleCache();
+                break;
+
+            case REPACK_KIT:
+                while (synth_->repackWanted()) synth_->repackKit();
+                break;
+        }
+    }
+
+    void useKit(const String& name, const ReverbSettings& reverb, uint32_t generation) {
+        kit_ = name;
+        generation_ = generation;
+        memset(pending_, 0, sizeof(pending_));
+        journaledReverb_ = reverb;
+        tickReverb_ = reverb;
+        journalRecords_ = 0;
+        foldJournal_ = true;
+    }
+
+    // moves the notes edited since the last call to pending_; true if there were any
+    bool takeEdits() {
+        uint32_t notes[4];
+        synth_->takeEditedNotes(notes);
+        uint32_t any = 0;
+        for (int i = 0; i < 4; ++i) {
+            pending_[i] |= notes[i];
+            any |= notes[i];
+        }
+        return any != 0;
+    }
+
+    // appends pending_ and a changed reverb to the journal of kit_
+    bool flush() {
+#ifndef AUTOSAVE_MS
+        return true;                // edits are only kept by a save from the menu
+#endif
+        if (kit_.isEmpty()) return true;
+        const ReverbSettings reverb = synth_->getReverb().getSettings();
+        const bool reverbChanged = reverb != journaledReverb_;
+        if (!(pending_[0] | pending_[1] | pending_[2] | pending_[3]) && !reverbChanged) return true;
+
+        const String path = DrumkitStorage::drumkitPath(DRUMKIT_DIR, kit_, KitFormat::JournalExtension);
+        int n = DrumkitStorage::appendJournal(*fs_, path.c_str(), generation_, synth_->getPatchMap(), pending_,
+                                              reverbChanged ? &reverb : nullptr);
+        if (n < 0) {
+            if (!autosaveFailed_) report("Autosave Failed");    // kept pending, tried again when idle
+            autosaveFailed_ = true;
+            return false;
+        }
+        autosaveFailed_ = false;
+        memset(pending_, 0, sizeof(pending_));
+        journaledReverb_ = reverb;
+        journalRecords_ = n;
+        return true;
+    }
+
+    // rewrites the kit file of kit_ from memory, dropping its journal
+    void compact() {
+        const ReverbSettings reverb = synth_->getReverb().getSettings();
+        if (DrumkitStorage::writeDrumkit(*fs_, DRUMKIT_DIR, kit_, synth_->getPatchMap(), reverb, nullptr, &generation_)) {
+            journaledReverb_ = reverb;
+            journalRecords_ = 0;
+        }
+    }
+
+    // nothing queued for AUTOSAVE_MS
+    void idle() {
+        if (kit_.isEmpty()) return;
+        bool editing = takeEdits();
+        const ReverbSettings reverb = synth_->getReverb().getSettings();
+        editing = editing || reverb != tickReverb_;
+        tickReverb_ = reverb;
+        if (editing) return;        // journal what has settled, not every encoder step
+
+        if (!flush()) return;
+        if (foldJournal_) {
+            foldJournal_ = false;
+            const String journal = DrumkitStorage::drumkitPath(DRUMKIT_DIR, kit_, KitFormat::JournalExtension);
+            if (fs_->exists(journal)) journalRecords_ = JOURNAL_COMPACT_RECORDS;
+        }
+        if (journalRecords_ >= JOURNAL_COMPACT_RECORDS) compact();
+    }
+
+    void listKits() {
+        std::vector<String> names = DrumkitStorage::listDrumkits(*fs_, DRUMKIT_DIR);
+        if (xSemaphoreTake(namesLock_, portMAX_DELAY) == pdTRUE) {
+            names_.swap(names);
+            xSemaphoreGive(namesLock_);
+        }
+    }
+};
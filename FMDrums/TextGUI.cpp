@@ -80,6 +80,15 @@ void TextGUI::process() {
 }
 
 void TextGUI::draw() {
+    if (posted) {
+        char text[sizeof(postedText)];
+        portENTER_CRITICAL(&postLock);
+        memcpy(text, postedText, sizeof(text));
+        posted = false;
+        portEXIT_CRITICAL(&postLock);
+        message(text);
+        return;
+    }
     if (pause_counter > 0) {
         pause_counter--;
         return;
@@ -249,7 +258,10 @@ void TextGUI::enterSubmenu(std::vector<MenuItem>&& items, const String& title, c
 
 void TextGUI::goBack() {
     if (menuStack.size() > 1) {
+        const bool leftEditor = (menuStack.back().midiNote >= 0);
         menuStack.pop_back();
+        // out of the patch editor: the edited patch gets its cached sample back
+        if (leftEditor && !inPatchEditor()) storage.post(StorageTask::REFRESH_SAMPLES);
 
         // Defensive check: reset any references to previous layer
         editingValue = false;
@@ -269,6 +281,15 @@ void TextGUI::message(const String& str) {
 }
 
 
+// the display belongs to the GUI task; other tasks leave their text here
+void TextGUI::postMessage(const char* str) {
+    portENTER_CRITICAL(&postLock);
+    strlcpy(postedText, str, sizeof(postedText));
+    posted = true;
+    portEXIT_CRITICAL(&postLock);
+}
+
+
 void TextGUI::refreshCurrentMenu() {
     if (menuStack.empty()) return;
 
@@ -319,11 +340,15 @@ void TextGUI::onButton0Event(MuxButton::btnEvents evt) {
                 break;
 
             case MenuItemType::ACTION:
-                if (item.command.action) item.command.action(*this);
+                if (item.command.action) {
+                    item.command.action(*this);
+                    patchEdited();
+                }
                 break;
 
             case MenuItemType::TOGGLE:
                 item.value.setter(!item.value.getter());
+                patchEdited();
                 needsRedraw = true;
                 break;
 
@@ -335,6 +360,7 @@ void TextGUI::onButton0Event(MuxButton::btnEvents evt) {
             case MenuItemType::CUSTOM:
                 if (item.custom.customAction) {
                     bool stay = item.custom.customAction(*this, 0);
+                    patchEdited();
                     if (!stay) {
                         goBack();  // Only call goBack() if customAction wants to exit
                     }
@@ -370,6 +396,7 @@ void TextGUI::onEncoderTurn(int direction) {
 
     if (item.type == MenuItemType::CUSTOM && item.custom.customAction) {
         item.custom.customAction(*this, direction);
+        patchEdited();
         return;
     }
 
@@ -396,6 +423,7 @@ void TextGUI::adjustValue(int direction, MenuItem& item) {
     if (newValue != current) {
 
         item.value.setter(newValue);
+        patchEdited();
         needsRedraw = true;
         ESP_LOGI(TAG, "Value adjusted to: %d :", newValue);
     }
@@ -423,6 +451,25 @@ int TextGUI::partialDisplayUpdate() {
     return cur_xt + cur_yt;
 }
 
+// Editors change synth.getPatchMap() in place; inside a patch editor (a menu level
+// opened with a midiNote) the synth has to recompile that note's patch. The storage
+// task rebuilds the compiled patches when that ran out of room.
+void TextGUI::patchEdited() {
+    for (auto it = menuStack.rbegin(); it != menuStack.rend(); ++it) {
+        if (it->midiNote >= 0) {
+            if (synth.patchChanged(it->midiNote)) storage.post(StorageTask::REPACK_KIT);
+            return;
+        }
+    }
+}
+
+bool TextGUI::inPatchEditor() const {
+    for (const auto& ctx : menuStack) {
+        if (ctx.midiNote >= 0) return true;
+    }
+    return false;
+}
+
 inline int TextGUI::getCurrentNote() const { 
     for (auto it = menuStack.rbegin(); it != menuStack.rend(); ++it) {
         if (it->midiNote >= 0) return it->midiNote;
@@ -435,4 +482,4 @@ inline int TextGUI::getCurrentNote() const {
     return ctx.cursorPosition;
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -35,6 +35,7 @@ public:
     void draw();
     void fullUpdate();
     void message(const String& str);
+    void postMessage(const char* str);   // any task: shown by the next draw()
     inline void pause(uint32_t count) { pause_counter = count; };
     void updateParentItemTitle(const String& newTitle);
 
@@ -57,6 +58,9 @@ public:
 
 private:
     volatile int32_t pause_counter = 0; // count down to 0 then process again
+    portMUX_TYPE postLock = portMUX_INITIALIZER_UNLOCKED;
+    char postedText[40] = {};           // postMessage() -> draw(), under postLock
+    volatile bool posted = false;
     bool inited = false; 
     MuxEncoder encoder;
     MuxButton button0;
@@ -88,6 +92,8 @@ private:
     int partialDisplayUpdate();
     
     // Value adjustment helpers
+    void patchEdited();
+    bool inPatchEditor() const;
     void adjustValue(int direction, MenuItem& item);
 
     inline void safeDrawUTF8(int x, int y, const char* str) {
@@ -97,4 +103,4 @@ private:
 
 };
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
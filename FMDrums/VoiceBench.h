@@ -0,0 +1,178 @@
+/*
+* VoiceBench - per-algorithm cost table for FmVoice6::process()
+*
+* Times every algorithm with the filter off and on, for each of the
+* Waveform types (all six operators set to the same waveform), and reports
+* ns per sample plus how many such voices fit into one core at SAMPLE_RATE.
+* From the worst waveform of each renderer it then prints the cost table of
+* FmVoice6 (renderCostTable) and the VOICE_COST_BUDGET that goes with it.
+* Given the synth's reverb, it times that in the same units as well, for
+* FmDrumSynth::ReverbRenderCost, and clears it again.
+* Runs both on the board (TASK_BENCHMARKING, see FMDrums.ino) and in the
+* host build (host/bench.cpp).
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include "misc.h"
+#include "FmVoice6.h"
+#include "FmPatch.h"
+#include "fx_reverb.h"
+
+namespace VoiceBench {
+
+using PrintFn = void (*)(const char*);
+
+// time budget per sample in ns, e.g. 22676 ns at 44.1 kHz
+static constexpr float BUDGET_NS = 1.0e9f / (float)SAMPLE_RATE;
+
+struct Result {
+    float nsPerSample[NUM_ALGOS][2][10];
+    float rendererNs[NUM_ALGOS * 4];    // worst ns per sample of each FmVoice6 renderer
+    float reverbNs;                     // FxReverb::processBlock(), if run() was given one
+};
+
+inline FmDrumPatch benchPatch(uint8_t algo, bool filter, Waveform wf) {
+    FmDrumPatch p;
+    strcpy(p.name, "Bench");
+    p.algoIndex = algo;
+    p.baseFreq = 110.0f;
+    p.attack = 0.0f;
+    p.hold = 0.0f;
+    p.decay = 1000.0f;   // keep the voice running for the whole measurement
+    p.sustain = 1.0f;
+    p.release = 1.0f;
+    p.useFilter = filter ? 1 : 0;
+    p.filterFreqHz = 3000.0f;
+    p.filterReso = 0.3f;
+    p.filterMorph = 0.33f;
+    for (int i = 0; i < 6; ++i) {
+        p.ops[i].ratio = 1.0f + 0.37f * i;
+        p.ops[i].detune = 0.0f;
+        p.ops[i].feedback = (i == 5) ? 2.0f : 0.0f;
+        p.ops[i].volume = 0.5f;
+        p.ops[i].waveform = wf;
+    }
+    return p;
+}
+
+// returns ns per sample for one voice setup: the fastest of four runs of blocks / 4,
+// so that an interrupt or a preempting task does not count
+inline float measure(FmVoice6& voice, const FmDrumPatch& patch, int blocks) {
+    voice.reset();
+    voice.applyPatch(patch);
+    voice.noteOn(60, 1.0f);
+    for (int i = 0; i < 4; ++i) voice.process(); // warm up caches
+
+    const int runBlocks = (blocks >= 4) ? blocks / 4 : 1;
+    uint32_t best = UINT32_MAX;
+    for (int r = 0; r < 4; ++r) {
+        uint32_t t0 = micros();
+        for (int b = 0; b < runBlocks; ++b) voice.process();
+        uint32_t t = micros() - t0;
+        if (t < best) best = t;
+    }
+
+    voice.noteOff();
+    return (float)best * 1000.0f / (float)(runBlocks * DMA_BUFFER_LEN);
+}
+
+// ns per sample of the reverb on a noise send bus, the fastest of four runs like
+// measure(); the copy of the send bus into the block is timed along
+inline float measureReverb(FxReverb& reverb, int blocks) {
+    alignas(16) static float noiseL[DMA_BUFFER_LEN], noiseR[DMA_BUFFER_LEN];
+    alignas(16) static float sendL[DMA_BUFFER_LEN], sendR[DMA_BUFFER_LEN];
+    uint32_t seed = 22222;
+    for (int i = 0; i < DMA_BUFFER_LEN; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        noiseL[i] = (float)(int32_t)seed * 2.0e-10f;   // about -14 dBFS, far above the silence threshold
+        seed = seed * 1664525u + 1013904223u;
+        noiseR[i] = (float)(int32_t)seed * 2.0e-10f;
+    }
+
+    const int runBlocks = (blocks >= 4) ? blocks / 4 : 1;
+    uint32_t best = UINT32_MAX;
+    for (int r = 0; r < 4; ++r) {
+        uint32_t t0 = micros();
+        for (int b = 0; b < runBlocks; ++b) {
+            memcpy(sendL, noiseL, sizeof(sendL));
+            memcpy(sendR, noiseR, sizeof(sendR));
+            reverb.processBlock(sendL, sendR);
+        }
+        uint32_t t = micros() - t0;
+        if (t < best) best = t;
+    }
+    reverb.clear();
+    return (float)best * 1000.0f / (float)(runBlocks * DMA_BUFFER_LEN);
+}
+
+inline void run(Result& res, PrintFn print, int blocks = 200, FxReverb* reverb = nullptr) {
+    static FmVoice6 voice;
+    char line[192];
+    for (float& ns : res.rendererNs) ns = 0.0f;
+
+    snprintf(line, sizeof(line), "FmVoice6::process() ns/sample, %d blocks of %d @ %d Hz, budget %.0f ns/sample\n",
+             blocks, DMA_BUFFER_LEN, SAMPLE_RATE, BUDGET_NS);
+    print(line);
+
+    int n = snprintf(line, sizeof(line), "algo flt");
+    for (size_t w = 0; w < Waveform::numOptions(); ++w)
+        n += snprintf(line + n, sizeof(line) - n, " %6s", Waveform((int)w).shortName().c_str());
+    snprintf(line + n, sizeof(line) - n, " | voices\n");
+    print(line);
+
+    for (int a = 0; a < NUM_ALGOS; ++a) {
+        for (int f = 0; f < 2; ++f) {
+            float worst = 0.0f;
+            n = snprintf(line, sizeof(line), "%4d %3s", a, f ? "on" : "off");
+            for (size_t w = 0; w < Waveform::numOptions(); ++w) {
+                float ns = measure(voice, benchPatch(a, f != 0, Waveform((int)w)), blocks);
+                res.nsPerSample[a][f][w] = ns;
+                if (ns > worst) worst = ns;
+                if (ns > res.rendererNs[voice.getRenderer()]) res.rendererNs[voice.getRenderer()] = ns;
+                n += snprintf(line + n, sizeof(line) - n, " %6.1f", ns);
+            }
+            snprintf(line + n, sizeof(line) - n, " | %6d\n", worst > 0.0f ? (int)(BUDGET_NS / worst) : 0);
+            print(line);
+        }
+    }
+
+    // the renderers in cost units, the dearest one being FmVoice6::MaxRenderCost
+    float worstNs = 0.0f;
+    for (float ns : res.rendererNs) if (ns > worstNs) worstNs = ns;
+    const float nsPerUnit = worstNs / FmVoice6::MaxRenderCost;
+    print("renderCostTable (any, sine only, any + filter, sine only + filter):\n");
+    for (int a = 0; a < NUM_ALGOS; ++a) {
+        n = snprintf(line, sizeof(line), "       ");
+        for (int k = 0; k < 4; ++k) {
+            int cost = nsPerUnit > 0.0f ? (int)ceilf(res.rendererNs[a * 4 + k] / nsPerUnit) : 0;
+            if (cost < 1) cost = 1;
+            n += snprintf(line + n, sizeof(line) - n, " %2d,", cost);
+        }
+        snprintf(line + n, sizeof(line) - n, "   // %d\n", a);
+        print(line);
+    }
+
+    res.reverbNs = 0.0f;
+    if (reverb && nsPerUnit > 0.0f) {
+        res.reverbNs = measureReverb(*reverb, blocks);
+        snprintf(line, sizeof(line), "FxReverb::processBlock() %.1f ns/sample -> ReverbRenderCost %d\n",
+                 res.reverbNs, (int)ceilf(res.reverbNs / nsPerUnit));
+        print(line);
+    }
+
+    // what the voices may take: 70% of the sample period, on both cores with the split
+#ifdef DUAL_CORE_RENDER
+    const float cores = 2.0f;
+#else
+    const float cores = 1.0f;
+#endif
+    snprintf(line, sizeof(line), "%.2f ns/sample per cost unit at worst -> VOICE_COST_BUDGET %d\n",
+             nsPerUnit, nsPerUnit > 0.0f ? (int)(0.7f * cores * BUDGET_NS / nsPerUnit) : 0);
+    print(line);
+}
+
+} // namespace VoiceBench
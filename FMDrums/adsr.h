@@ -1,5 +1,6 @@
 #pragma once
-#include <Arduino.h>
+#include "platform.h"
+#include "config.h"
 #include <math.h>
 
 /** adsr envelope module
@@ -14,6 +15,7 @@ Unified D0 calculation
 Fixed setting targets for different starting/ending points
 Made epsylon neibourhood configurable via static const
 Made it header-only
+Added control-rate block rendering (processBlock)
 */
 
 class IRAM_ATTR Adsr {
@@ -92,7 +94,7 @@ public:
     }
 
     float getPenalty() const  {
-        eSegment_t seg;
+        eSegment_t seg = mode_;
         if (gate_ && (x_ == sus_level_)) seg = ADSR_SEG_SUSTAIN;
         switch (seg) {
             case ADSR_SEG_ATTACK: return 0.0f;
@@ -108,10 +110,55 @@ public:
     }
 
     inline bool isRunning() const { return mode_ != ADSR_SEG_IDLE; }
+    // past attack and hold: from here on the level only goes down
+    inline bool isDecaying() const { return mode_ >= ADSR_SEG_DECAY; }
     inline bool isIdle() const { return mode_ == ADSR_SEG_IDLE; }
     inline float getVal() const { return x_; }
     inline float getTarget() const { return target_; }
 
+    // Patch-dependent part of the envelope, precomputed by makeParams()
+    // so that setParams() needs no powf()
+    struct Params {
+        float attackTime, holdTime, decayTime, sustain, releaseTime;
+        float attackD0, decayD0, releaseD0;
+        float attackDK, decayDK, releaseDK;
+        uint32_t holdSamples;
+    };
+
+    static Params makeParams(float sampleRate, float a, float h, float d, float s, float r) {
+        Params p;
+        p.attackTime = a;
+        p.holdTime = h;
+        p.decayTime = d;
+        p.releaseTime = r;
+        p.sustain = (s <= 0.f) ? -0.001f : (s > 1.f) ? 1.f : s;
+        p.attackD0 = timeConstant(sampleRate, a);
+        p.decayD0 = timeConstant(sampleRate, d);
+        p.releaseD0 = timeConstant(sampleRate, r);
+        p.attackDK = timeConstant(sampleRate / ControlRate, a);
+        p.decayDK = timeConstant(sampleRate / ControlRate, d);
+        p.releaseDK = timeConstant(sampleRate / ControlRate, r);
+        p.holdSamples = h > 0.0f ? (uint32_t)(h * sampleRate) : 0;
+        return p;
+    }
+
+    void setParams(const Params& p) {
+        attackTime_ = p.attackTime;
+        holdTime_ = p.holdTime;
+        decayTime_ = p.decayTime;
+        releaseTime_ = p.releaseTime;
+        sus_level_ = p.sustain;
+        attackD0_ = p.attackD0;
+        decayD0_ = p.decayD0;
+        releaseD0_ = p.releaseD0;
+        attackDK_ = p.attackDK;
+        decayDK_ = p.decayDK;
+        releaseDK_ = p.releaseDK;
+        holdSamples_ = holdCounter_ = p.holdSamples;
+    }
+
+    inline int getSampleRate() const { return sample_rate_; }
+
     inline float getAttackTime() const { return attackTime_; }
     inline float getHoldTime() const { return holdTime_; }
     inline float getDecayTime() const { return decayTime_; }
@@ -123,10 +170,10 @@ public:
         switch (seg) {
             case ADSR_SEG_ATTACK: setAttackTime(time); break;
             case ADSR_SEG_HOLD: setHoldTime(time); break;
-            case ADSR_SEG_DECAY: setTimeConstant(time, decayTime_, decayD0_); break;
-            case ADSR_SEG_RELEASE: setTimeConstant(time, releaseTime_, releaseD0_); break;
-            case ADSR_SEG_FAST_RELEASE: setTimeConstant(time, fastReleaseTime_, fastReleaseD0_); break;
-            case ADSR_SEG_SEMI_FAST_RELEASE: setTimeConstant(time, semiFastReleaseTime_, semiFastReleaseD0_); break;
+            case ADSR_SEG_DECAY: setDecayTime(time); break;
+            case ADSR_SEG_RELEASE: setReleaseTime(time); break;
+            case ADSR_SEG_FAST_RELEASE: setFastReleaseTime(time); break;
+            case ADSR_SEG_SEMI_FAST_RELEASE: setSemiFastReleaseTime(time); break;
             default: break;
         }
     }
@@ -137,11 +184,11 @@ public:
         holdCounter_ = holdSamples_;
     }
 
-    void setAttackTime(float timeInS) { setTimeConstant(timeInS, attackTime_, attackD0_); }
-    void setDecayTime(float timeInS) { setTimeConstant(timeInS, decayTime_, decayD0_); }
-    void setReleaseTime(float timeInS) { setTimeConstant(timeInS, releaseTime_, releaseD0_); }
-    void setFastReleaseTime(float timeInS) { setTimeConstant(timeInS, fastReleaseTime_, fastReleaseD0_); }
-    void setSemiFastReleaseTime(float timeInS) { setTimeConstant(timeInS, semiFastReleaseTime_, semiFastReleaseD0_); }
+    void setAttackTime(float timeInS) { setTimeConstant(timeInS, attackTime_, attackD0_, attackDK_); }
+    void setDecayTime(float timeInS) { setTimeConstant(timeInS, decayTime_, decayD0_, decayDK_); }
+    void setReleaseTime(float timeInS) { setTimeConstant(timeInS, releaseTime_, releaseD0_, releaseDK_); }
+    void setFastReleaseTime(float timeInS) { setTimeConstant(timeInS, fastReleaseTime_, fastReleaseD0_, fastReleaseDK_); }
+    void setSemiFastReleaseTime(float timeInS) { setTimeConstant(timeInS, semiFastReleaseTime_, semiFastReleaseD0_, semiFastReleaseDK_); }
 
     inline void setSustainLevel(float sus_level) {
         sus_level = (sus_level <= 0.f) ? -0.001f : (sus_level > 1.f) ? 1.f : sus_level;
@@ -199,20 +246,80 @@ public:
         return out;
     }
 
+    // Renders n samples of process() into out. With ENV_CONTROL_RATE > 1 the envelope
+    // advances once per ControlRate samples, in closed form, and is ramped linearly in
+    // between. A sub-block in which a segment would end, and a trailing partial one,
+    // run per sample instead, so attack peak, hold length and the end of the release
+    // land on the same samples as with process().
+    void __attribute__((hot)) IRAM_ATTR processBlock(float* out, int n) {
+        int i = 0;
+        if constexpr (ControlRate > 1) {
+            for (; i + ControlRate <= n; i += ControlRate) {
+                if (!rampStep(out + i)) {
+                    for (int j = 0; j < ControlRate; ++j) out[i + j] = process();
+                }
+            }
+        }
+        for (; i < n; ++i) out[i] = process();
+    }
+
+    static constexpr int ControlRate = ENV_CONTROL_RATE;
+
 private:
     static constexpr float epsylon = 0.01f;
     static constexpr float epsylon2 = epsylon / (1.0f + epsylon);
-    void setTimeConstant(float timeInS, float& time, float& coeff) {
+    static constexpr float MaxRampStep = 0.125f;  // share of the way to the target one control step may cover: with 16-sample steps at 44.1 kHz, segments shorter than ~12 ms run per sample
+    void setTimeConstant(float timeInS, float& time, float& coeff, float& coeffK) {
         if (timeInS != time) {
             time = timeInS;
-            coeff = (time > 0.f) ? 1.0f - powf(epsylon2, 1.0f / (sample_rate_ * time)) : 1.f;
+            coeff = timeConstant((float)sample_rate_, time);
+            coeffK = timeConstant((float)sample_rate_ / ControlRate, time);
+        }
+    }
+
+    // one control step: ControlRate samples of the current segment as a linear ramp;
+    // false, with nothing changed, if the segment ends within them
+    inline bool __attribute__((always_inline)) IRAM_ATTR rampStep(float* out) {
+        float dk;
+        switch (mode_) {
+            case ADSR_SEG_IDLE:
+                for (int j = 0; j < ControlRate; ++j) out[j] = 0.0f;
+                return true;
+            case ADSR_SEG_HOLD:
+                if (holdCounter_ < (uint32_t)ControlRate) return false;
+                holdCounter_ -= ControlRate;
+                for (int j = 0; j < ControlRate; ++j) out[j] = x_;
+                return true;
+            case ADSR_SEG_ATTACK:               dk = attackDK_; break;
+            case ADSR_SEG_DECAY:                dk = decayDK_; break;
+            case ADSR_SEG_RELEASE:              dk = releaseDK_; break;
+            case ADSR_SEG_FAST_RELEASE:         dk = fastReleaseDK_; break;
+            case ADSR_SEG_SEMI_FAST_RELEASE:    dk = semiFastReleaseDK_; break;
+            default: return false;
+        }
+        // a segment this steep bends too much for a straight line
+        if (dk > MaxRampStep) return false;
+        const float xe = x_ + dk * (((mode_ == ADSR_SEG_ATTACK) ? attackTarget_ : target_) - x_);
+        if (xe >= 1.f || xe < 0.0f) return false;
+        const float step = (xe - x_) * (1.0f / ControlRate);
+        float x = x_;
+        for (int j = 0; j < ControlRate; ++j) {
+            x += step;
+            out[j] = x;
         }
+        x_ = xe;
+        return true;
+    }
+
+    static float timeConstant(float sampleRate, float time) {
+        return (time > 0.f) ? 1.0f - powf(epsylon2, 1.0f / (sampleRate * time)) : 1.f;
     }
 
     float sus_level_{0.f}, x_{0.f}, target_{0.f}, D0_{0.f};
     float attackTarget_{1.0f}, attackTime_{-1.0f};
     float decayTime_{-1.0f}, releaseTime_{-1.0f}, fastReleaseTime_{-1.0f}, semiFastReleaseTime_{-1.0f};
     float attackD0_{0.f}, decayD0_{0.f}, releaseD0_{0.f}, fastReleaseD0_{0.f}, semiFastReleaseD0_{0.f};
+    float attackDK_{0.f}, decayDK_{0.f}, releaseDK_{0.f}, fastReleaseDK_{0.f}, semiFastReleaseDK_{0.f};    // per ControlRate samples
     float holdTime_ = 0.0f;
     uint32_t holdSamples_ = 0, holdCounter_ = 0;
     int sample_rate_;
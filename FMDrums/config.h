@@ -35,9 +35,24 @@
 #define   NUM_MIDI_CHANNELS		16
 
 // ===================== SYNTHESIZER ================================================================================
-#define MAX_VOICES 10 
+#define MAX_VOICES 32   // voices the allocator has; VOICE_COST_BUDGET limits how many sound
 #define MAX_VOICES_PER_NOTE 2
+#define PATCH_POOL_SPARE 16    // free compiled patches a kit keeps for edits, see PatchPool.h
+#define VOICE_COST_BUDGET 600  // render cost the voices may add up to, a host estimate (see DrumVoiceAllocator.h); comment out for MAX_VOICES only
+#define OP_BANK_VOICES (MAX_VOICES + 2)  // FmOperatorBank slots: the synth voices + one for VoiceBench / previews + the SampleCache renderer
+#define EVENT_QUEUE_SIZE 256  // MIDI -> audio task events, power of two
+#define SILENCE_THRESHOLD_DB -90.0f  // voices and reverb tail below this count as silent: voices end early, the reverb skips blocks; comment out to always run them
+#define SILENCE_HOLD_BLOCKS 8        // blocks in a row a decaying voice has to stay below the threshold before it is ended
+#define ENV_CONTROL_RATE 16   // samples per envelope step, linear ramps in between (see Adsr::processBlock); 1 = every sample
 #define PITCH_BEND_CENTER 0
+#define DUAL_CORE_RENDER      // comment this out to render all voices on core 0; otherwise a task on core 1 takes a share
+// #define FIXED_POINT_ENGINE // voices render in integer Q formats (32-bit phase, Q30 sine, Q31 envelope), see FmOperator::processBlock()
+#define REVERB_PIPELINE       // reverb on core 1, one block behind the dry signal; can also be switched off in the Reverb menu
+#define REVERB_FADE_BLOCKS 32 // blocks over which the reverb glides to the settings of a newly loaded kit
+#define REVERB_EDIT_BLOCKS 4  // blocks over which the reverb glides to a setting changed in the menu
+// #define SAMPLE_CACHE       // one-shot patches play from samples pre-rendered to PSRAM, see SampleCache.h
+#define SAMPLE_CACHE_KB 4096      // PSRAM the cached samples may take
+#define SAMPLE_CACHE_MAX_MS 3000  // longest one-shot; a patch that rings on longer stays on FM
 
 //#define ENABLE_IN_VOICE_FILTERS       // comment this out to disable voice SF2 filters
 //#define ENABLE_REVERB                 // comment this out to disable reverb 
@@ -53,6 +68,8 @@
 
 #define PRESET_DIR "/presets"
 #define DRUMKIT_DIR "/drumkits"
+#define AUTOSAVE_MS 1000            // edits go to the kit's journal once they have rested this long (see StorageTask.h); comment out to save from the menu only
+#define JOURNAL_COMPACT_RECORDS 64  // journal length (a record of ~200 bytes per edited patch) at which the kit file is rewritten
 
 // ===================== MIDI PINS ==================================================================================
 #define MIDI_IN         15      // if USE_MIDI_STANDARD is selected as MIDI_IN, this pin receives MIDI messages
@@ -111,6 +128,7 @@
 // ===================== DEBUGGING ==================================================================================
 
 // #define TASK_BENCHMARKING
+#define PROFILER_DUMP_MS 5000   // with TASK_BENCHMARKING: render profile printed to Serial this often
 
  
 
@@ -120,6 +138,7 @@
 // !!!!!!!!!!!!!=======  DO NOT CHANGE  =======!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
 
+#if defined(ARDUINO)
 #ifdef USE_SD
   #include <SD_MMC.h>
   #define FS_USED SD_MMC
@@ -127,9 +146,11 @@
   #include <LittleFS.h>
   #define FS_USED LittleFS
 #endif
+#endif
 
 #define USE_SIN_LUT
 #define SIN_FUNC_NORM(x) sin_lut(x)
+#define SIN_FUNC_PHASE(p) sin_lut_u32(p) // same for a 32-bit phase, 2^32 = one turn
 
 // U8G2 CONSTRUCTOR MACROS
 #if (DISPLAY_ROTATE == 180)
@@ -0,0 +1,300 @@
+/*
+* DspKernels - block kernels for the mixing and output stages
+*
+* Every kernel has a portable scalar version (DspKernels::Scalar), which is
+* what the host build runs, and on the ESP32-S3 a version using the PIE
+* 128-bit FPU loads/stores (EE.LDF.128.IP / EE.STF.128.IP). PIE has no float
+* vector arithmetic, so the math itself stays on the scalar FPU in exactly
+* the same order as the C code: results are bit-identical. init() checks
+* that on random data and falls back to the scalar path if anything differs.
+*
+* The PIE path is used for 16-byte aligned buffers whose length is a
+* multiple of 4; anything else silently goes scalar.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "platform.h"
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(DSP_KERNELS_SCALAR)
+  #define DSP_KERNELS_PIE
+#endif
+
+namespace DspKernels {
+
+// ===================== portable reference ==========================================================================
+namespace Scalar {
+
+// Adds one voice to the dry buses and the reverb send buses:
+// s = gain * in; outL += s * panL; outR += s * panR; sendL/R += s * send
+inline void __attribute__((optimize("fp-contract=off"))) IRAM_ATTR
+mixVoice(float* outL, float* outR, float* sendL, float* sendR, const float* in,
+         float gain, float panL, float panR, float send, int n) {
+    for (int i = 0; i < n; ++i) {
+        float s = gain * in[i];
+        outL[i] += s * panL;
+        outR[i] += s * panR;
+        float r = s * send;
+        sendL[i] += r;
+        sendR[i] += r;
+    }
+}
+
+// dst += src
+inline void IRAM_ATTR add(float* dst, const float* src, int n) {
+    for (int i = 0; i < n; ++i) dst[i] += src[i];
+}
+
+// max |x|, for the silence detection
+inline float IRAM_ATTR peak(const float* x, int n) {
+    float p = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        const float a = fabsf(x[i]);
+        if (a > p) p = a;
+    }
+    return p;
+}
+
+// Interleaved 16-bit stereo, one 32-bit word per frame: L in the low half, R in the high half.
+// Same conversion as I2S_Audio::convertOutSample(): truncated, not clipped.
+inline void IRAM_ATTR toI16Stereo(uint32_t* dst, const float* L, const float* R, float scale, int n) {
+    for (int i = 0; i < n; ++i) {
+        int16_t l = (int32_t)(L[i] * scale);
+        int16_t r = (int32_t)(R[i] * scale);
+        dst[i] = (uint16_t)l | ((uint32_t)(uint16_t)r << 16);
+    }
+}
+
+} // namespace Scalar
+
+// ===================== ESP32-S3 PIE ================================================================================
+#ifdef DSP_KERNELS_PIE
+namespace Pie {
+
+// n % 4 == 0, all pointers 16-byte aligned
+inline void IRAM_ATTR mixVoice(float* outL, float* outR, float* sendL, float* sendR, const float* in,
+                               float gain, float panL, float panR, float send, int n) {
+    int cnt = n >> 2;
+    if (cnt <= 0) return;
+    asm volatile (
+        "1:                                              \n"
+        "ee.ldf.128.ip  f3, f2, f1, f0, %[in], 16        \n"
+        "mul.s  f0, f0, %[g]                             \n"
+        "mul.s  f1, f1, %[g]                             \n"
+        "mul.s  f2, f2, %[g]                             \n"
+        "mul.s  f3, f3, %[g]                             \n"
+        // outL
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[oL], 0         \n"
+        "mul.s  f8,  f0, %[pl]                           \n"
+        "mul.s  f9,  f1, %[pl]                           \n"
+        "mul.s  f10, f2, %[pl]                           \n"
+        "mul.s  f11, f3, %[pl]                           \n"
+        "add.s  f4, f4, f8                               \n"
+        "add.s  f5, f5, f9                               \n"
+        "add.s  f6, f6, f10                              \n"
+        "add.s  f7, f7, f11                              \n"
+        "ee.stf.128.ip  f7, f6, f5, f4, %[oL], 16        \n"
+        // outR
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[oR], 0         \n"
+        "mul.s  f8,  f0, %[pr]                           \n"
+        "mul.s  f9,  f1, %[pr]                           \n"
+        "mul.s  f10, f2, %[pr]                           \n"
+        "mul.s  f11, f3, %[pr]                           \n"
+        "add.s  f4, f4, f8                               \n"
+        "add.s  f5, f5, f9                               \n"
+        "add.s  f6, f6, f10                              \n"
+        "add.s  f7, f7, f11                              \n"
+        "ee.stf.128.ip  f7, f6, f5, f4, %[oR], 16        \n"
+        // sends
+        "mul.s  f8,  f0, %[sd]                           \n"
+        "mul.s  f9,  f1, %[sd]                           \n"
+        "mul.s  f10, f2, %[sd]                           \n"
+        "mul.s  f11, f3, %[sd]                           \n"
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[sL], 0         \n"
+        "add.s  f4, f4, f8                               \n"
+        "add.s  f5, f5, f9                               \n"
+        "add.s  f6, f6, f10                              \n"
+        "add.s  f7, f7, f11                              \n"
+        "ee.stf.128.ip  f7, f6, f5, f4, %[sL], 16        \n"
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[sR], 0         \n"
+        "add.s  f4, f4, f8                               \n"
+        "add.s  f5, f5, f9                               \n"
+        "add.s  f6, f6, f10                              \n"
+        "add.s  f7, f7, f11                              \n"
+        "ee.stf.128.ip  f7, f6, f5, f4, %[sR], 16        \n"
+        "addi   %[cnt], %[cnt], -1                       \n"
+        "bnez   %[cnt], 1b                               \n"
+        : [in] "+r"(in), [oL] "+r"(outL), [oR] "+r"(outR), [sL] "+r"(sendL), [sR] "+r"(sendR), [cnt] "+r"(cnt)
+        : [g] "f"(gain), [pl] "f"(panL), [pr] "f"(panR), [sd] "f"(send)
+        : "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10", "f11", "memory"
+    );
+}
+
+// n % 4 == 0, all pointers 16-byte aligned
+inline void IRAM_ATTR add(float* dst, const float* src, int n) {
+    int cnt = n >> 2;
+    if (cnt <= 0) return;
+    asm volatile (
+        "1:                                              \n"
+        "ee.ldf.128.ip  f3, f2, f1, f0, %[s], 16         \n"
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[d], 0          \n"
+        "add.s  f4, f4, f0                               \n"
+        "add.s  f5, f5, f1                               \n"
+        "add.s  f6, f6, f2                               \n"
+        "add.s  f7, f7, f3                               \n"
+        "ee.stf.128.ip  f7, f6, f5, f4, %[d], 16         \n"
+        "addi   %[cnt], %[cnt], -1                       \n"
+        "bnez   %[cnt], 1b                               \n"
+        : [s] "+r"(src), [d] "+r"(dst), [cnt] "+r"(cnt)
+        :
+        : "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "memory"
+    );
+}
+
+// n % 4 == 0, all pointers 16-byte aligned
+inline void IRAM_ATTR toI16Stereo(uint32_t* dst, const float* L, const float* R, float scale, int n) {
+    int cnt = n >> 2;
+    if (cnt <= 0) return;
+    int a, b;
+    asm volatile (
+        "1:                                              \n"
+        "ee.ldf.128.ip  f3, f2, f1, f0, %[L], 16         \n"
+        "ee.ldf.128.ip  f7, f6, f5, f4, %[R], 16         \n"
+        "mul.s  f0, f0, %[k]                             \n"
+        "mul.s  f4, f4, %[k]                             \n"
+        "mul.s  f1, f1, %[k]                             \n"
+        "mul.s  f5, f5, %[k]                             \n"
+        "mul.s  f2, f2, %[k]                             \n"
+        "mul.s  f6, f6, %[k]                             \n"
+        "mul.s  f3, f3, %[k]                             \n"
+        "mul.s  f7, f7, %[k]                             \n"
+        "trunc.s %[a], f0, 0                             \n"
+        "trunc.s %[b], f4, 0                             \n"
+        "extui  %[a], %[a], 0, 16                        \n"
+        "slli   %[b], %[b], 16                           \n"
+        "or     %[a], %[a], %[b]                         \n"
+        "s32i   %[a], %[d], 0                            \n"
+        "trunc.s %[a], f1, 0                             \n"
+        "trunc.s %[b], f5, 0                             \n"
+        "extui  %[a], %[a], 0, 16                        \n"
+        "slli   %[b], %[b], 16                           \n"
+        "or     %[a], %[a], %[b]                         \n"
+        "s32i   %[a], %[d], 4                            \n"
+        "trunc.s %[a], f2, 0                             \n"
+        "trunc.s %[b], f6, 0                             \n"
+        "extui  %[a], %[a], 0, 16                        \n"
+        "slli   %[b], %[b], 16                           \n"
+        "or     %[a], %[a], %[b]                         \n"
+        "s32i   %[a], %[d], 8                            \n"
+        "trunc.s %[a], f3, 0                             \n"
+        "trunc.s %[b], f7, 0                             \n"
+        "extui  %[a], %[a], 0, 16                        \n"
+        "slli   %[b], %[b], 16                           \n"
+        "or     %[a], %[a], %[b]                         \n"
+        "s32i   %[a], %[d], 12                           \n"
+        "addi   %[d], %[d], 16                           \n"
+        "addi   %[cnt], %[cnt], -1                       \n"
+        "bnez   %[cnt], 1b                               \n"
+        : [L] "+r"(L), [R] "+r"(R), [d] "+r"(dst), [cnt] "+r"(cnt), [a] "=&r"(a), [b] "=&r"(b)
+        : [k] "f"(scale)
+        : "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "memory"
+    );
+}
+
+} // namespace Pie
+#endif // DSP_KERNELS_PIE
+
+// ===================== dispatch ====================================================================================
+
+// set by init() once the PIE kernels have matched the scalar ones
+inline bool pieEnabled = false;
+
+inline bool IRAM_ATTR pieOk(const void* a, const void* b, int n) {
+    return pieEnabled && ((((uintptr_t)a | (uintptr_t)b) & 15) == 0) && ((n & 3) == 0);
+}
+
+inline void IRAM_ATTR mixVoice(float* outL, float* outR, float* sendL, float* sendR, const float* in,
+                               float gain, float panL, float panR, float send, int n) {
+#ifdef DSP_KERNELS_PIE
+    if (pieOk(outL, outR, n) && pieOk(sendL, sendR, n) && pieOk(in, in, n)) {
+        Pie::mixVoice(outL, outR, sendL, sendR, in, gain, panL, panR, send, n);
+        return;
+    }
+#endif
+    Scalar::mixVoice(outL, outR, sendL, sendR, in, gain, panL, panR, send, n);
+}
+
+inline void IRAM_ATTR add(float* dst, const float* src, int n) {
+#ifdef DSP_KERNELS_PIE
+    if (pieOk(dst, src, n)) {
+        Pie::add(dst, src, n);
+        return;
+    }
+#endif
+    Scalar::add(dst, src, n);
+}
+
+inline void IRAM_ATTR toI16Stereo(uint32_t* dst, const float* L, const float* R, float scale, int n) {
+#ifdef DSP_KERNELS_PIE
+    if (pieOk(L, R, n) && pieOk(dst, dst, n)) {
+        Pie::toI16Stereo(dst, L, R, scale, n);
+        return;
+    }
+#endif
+    Scalar::toI16Stereo(dst, L, R, scale, n);
+}
+
+inline float IRAM_ATTR peak(const float* x, int n) {
+    return Scalar::peak(x, n);     // compare-bound, nothing for PIE to win
+}
+
+inline const char* implName() { return pieEnabled ? "PIE" : "scalar"; }
+
+// Runs every PIE kernel against its scalar version on pseudo-random data and
+// enables the PIE path only if all results are bit-identical.
+// Returns false on a mismatch; on targets without PIE there is nothing to check.
+inline bool init() {
+    pieEnabled = false;
+#ifdef DSP_KERNELS_PIE
+    constexpr int N = 64;
+    alignas(16) static float in[N], a[4][N], b[4][N], src[N];
+    alignas(16) static uint32_t wa[N], wb[N];
+    uint32_t seed = 0x1234567u;
+    auto rnd = [&seed]() {  // -1.5 .. 1.5, so the conversion test also covers overflowing samples
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(int32_t)seed * (1.5f / 2147483648.0f);
+    };
+    for (int i = 0; i < N; ++i) {
+        in[i] = rnd();
+        src[i] = rnd();
+        for (int k = 0; k < 4; ++k) a[k][i] = b[k][i] = rnd();
+    }
+
+    bool ok = true;
+    Scalar::mixVoice(a[0], a[1], a[2], a[3], in, 0.25f, 0.7f, 0.3f, 0.45f, N);
+    Pie::mixVoice(b[0], b[1], b[2], b[3], in, 0.25f, 0.7f, 0.3f, 0.45f, N);
+    if (memcmp(a, b, sizeof(a)) != 0) { ESP_LOGE("DspKernels", "mixVoice mismatch"); ok = false; }
+
+    Scalar::add(a[0], src, N);
+    Pie::add(b[0], src, N);
+    if (memcmp(a[0], b[0], sizeof(a[0])) != 0) { ESP_LOGE("DspKernels", "add mismatch"); ok = false; }
+
+    Scalar::toI16Stereo(wa, in, src, 32767.0f, N);
+    Pie::toI16Stereo(wb, in, src, 32767.0f, N);
+    if (memcmp(wa, wb, sizeof(wa)) != 0) { ESP_LOGE("DspKernels", "toI16Stereo mismatch"); ok = false; }
+
+    pieEnabled = ok;
+    if (!ok) ESP_LOGE("DspKernels", "PIE kernels disabled, using scalar fallback");
+    return ok;
+#else
+    return true;
+#endif
+}
+
+} // namespace DspKernels
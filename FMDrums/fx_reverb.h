@@ -4,6 +4,8 @@
 * stereo processing of a mono input signal
 * has a pre-delay setting 0..MAX_PREDELAY_MS
 * has damping setting 0..1
+* skips whole blocks while input and tail are below SILENCE_THRESHOLD_DB
+* glides to new settings block by block with fadeTo()
 * 
 * May 2025
 * Author: Evgeny Aslovskiy AKA Copych
@@ -12,6 +14,8 @@
 
 #pragma once
 #include "config.h"
+#include "misc.h"
+#include "dsp_kernels.h"
 
 #ifdef BOARD_HAS_PSRAM 
   #define REV_MULTIPLIER 1.8f
@@ -33,6 +37,30 @@ const DRAM_ATTR float comb_damping_coef[NUM_COMBS] = {0.83f, 0.9f, 1.0f, 0.8f};
 const DRAM_ATTR float allpass_lengths[NUM_ALLPASSES] = {500.0f, 168.0f, 48.0f};
 const DRAM_ATTR float allpass_gains[NUM_ALLPASSES]   = {0.707f, 0.707f, 0.707f};
 
+// The settings a drumkit carries. The setter names are FxReverb's, so a kit
+// loader fills either one.
+struct ReverbSettings {
+  float time = 0.8f;
+  float level = 0.5f;
+  float damping = 0.6f;
+  float preDelayMs = 10.0f;
+
+  inline void setTime(float v)         { time = v; }
+  inline void setLevel(float v)        { level = v; }
+  inline void setDamping(float v)      { damping = v; }
+  inline void setPreDelayTime(float v) { preDelayMs = v; }
+
+  inline float getTime() const         { return time; }
+  inline float getLevel() const        { return level; }
+  inline float getDamping() const      { return damping; }
+  inline float getPreDelayTime() const { return preDelayMs; }
+
+  inline bool operator==(const ReverbSettings& o) const {
+    return time == o.time && level == o.level && damping == o.damping && preDelayMs == o.preDelayMs;
+  }
+  inline bool operator!=(const ReverbSettings& o) const { return !(*this == o); }
+};
+
 class IRAM_ATTR FxReverb {
 public:
   FxReverb() {}
@@ -79,6 +107,26 @@ public:
     setTime(0.8f);
     setPreDelayTime(10.0f);
     setDamping(0.6f);
+#ifdef SILENCE_THRESHOLD_DB
+    setSilenceThreshold(SILENCE_THRESHOLD_DB);
+#endif
+  }
+
+  // empties the delay lines, as after init(); VoiceBench times the synth's reverb
+  // before the audio starts and leaves no tail of its test signal behind
+  inline void clear() {
+    for (int ch = 0; ch < 2; ++ch) {
+      for (int i = 0; i < NUM_COMBS; ++i) {
+        if (combBuf[ch][i]) memset(combBuf[ch][i], 0, sizeof(float) * combSize[ch][i]);
+        combStore[ch][i] = 0.0f;
+      }
+      for (int i = 0; i < NUM_ALLPASSES; ++i) {
+        if (allpassBuf[ch][i]) memset(allpassBuf[ch][i], 0, sizeof(float) * allpassSize[ch][i]);
+      }
+    }
+    if (predelayBuf) memset(predelayBuf, 0, sizeof(float) * predelaySize);
+    quietIn = quietOut = 0;
+    blocks = skippedBlocks = 0;
   }
 
   inline float getTime() const {  return rev_time;  }
@@ -88,35 +136,82 @@ public:
   
 
   inline void setPreDelayTime(float ms) {
-    delaySamples = int(ms * 0.001f * (float)SAMPLE_RATE);
-    if (delaySamples >= predelaySize) delaySamples = predelaySize - 1;
-    if (delaySamples < 0) delaySamples = 0;
-    predelayReadOffset = (predelayPtr - delaySamples + predelaySize) % predelaySize;
-
+    settings.preDelayMs = ms;
+    applyPreDelay(ms * 0.001f * (float)SAMPLE_RATE);
     ESP_LOGD("Reverb", "Pre-delay set to %.1f ms (%d samples)", ms, delaySamples);
   }
 
   inline void setTime(float value) {
-    rev_time = 0.998f * value + 0.001f;
-    for (int ch = 0; ch < 2; ++ch) {
-      for (int i = 0; i < NUM_COMBS; ++i)
-        combLim[ch][i] = int(rev_time * combSize[ch][i]);
-      for (int i = 0; i < NUM_ALLPASSES; ++i)
-        allpassLim[ch][i] = int(rev_time * allpassSize[ch][i]);
-    }
+    settings.time = value;
+    applyTime(0.998f * value + 0.001f);
   }
 
-  inline void setLevel(float value) {     rev_level = value;   }
+  inline void setLevel(float value) {     settings.level = value; rev_level = value;   }
   
   inline void setDamping(float d) {
-    globalDamping = d < 0.0f ? 0.0f : (d > 1.0f ? 1.0f : d);
-    for (int i = 0; i < NUM_COMBS; ++i) {
-      comb_dampings[i] = globalDamping * comb_damping_coef[i] ;
-    }
+    settings.damping = d;
+    applyDamping(d);
     ESP_LOGI("Reverb", "Global damping set to %.2f", globalDamping);
   }
+
+  // the values last set; unlike getTime() they read back unchanged
+  inline const ReverbSettings& getSettings() const { return settings; }
+
+  // what getSettings() reports while a fadeTo(s) is on its way from another task
+  inline void setFadeSettings(const ReverbSettings& s) { settings = s; }
+
+  inline void setSettings(const ReverbSettings& s) {
+    setTime(s.time);
+    setLevel(s.level);
+    setDamping(s.damping);
+    setPreDelayTime(s.preDelayMs);
+  }
+
+  // Moves to s in equal steps at the start of the next `blocks` processBlock() calls,
+  // so a kit change does not jump the comb lengths, level and pre-delay all at once.
+  // Call it from the task that runs processBlock(), or while no block is in flight;
+  // getSettings() stays as it was, see setFadeSettings().
+  inline void fadeTo(const ReverbSettings& s, int blocks) {
+    fadeFrom[0] = rev_time;
+    fadeFrom[1] = rev_level;
+    fadeFrom[2] = globalDamping;
+    fadeFrom[3] = (float)delaySamples;
+    fadeTarget[0] = 0.998f * s.time + 0.001f;
+    fadeTarget[1] = s.level;
+    fadeTarget[2] = s.damping;
+    fadeTarget[3] = s.preDelayMs * 0.001f * (float)SAMPLE_RATE;
+    fadeBlocks = blocks > 0 ? blocks : 1;
+    fadeLeft = fadeBlocks;
+  }
   
+  // silence detection: level in dBFS below which input and tail count as silent
+  void setSilenceThreshold(float dB) { silenceLevel = powf(10.0f, dB * 0.05f); }
+
+  // blocks processed / skipped as silent, since init()
+  inline uint32_t getBlocks() const { return blocks; }
+  inline uint32_t getSkippedBlocks() const { return skippedBlocks; }
+
   inline void  __attribute__((hot,always_inline)) IRAM_ATTR processBlock(float* signal_l, float* signal_r) {
+    ++blocks;
+    if (fadeLeft > 0) stepFade();
+#ifdef SILENCE_THRESHOLD_DB
+    // Once the input has stayed below the threshold for longer than the pre-delay and
+    // the output for longer than the longest comb plus the allpasses, every delay line
+    // only holds what is below the threshold too: the block can be skipped, frozen
+    // state and all, until the input comes back
+    if (DspKernels::peak(signal_l, DMA_BUFFER_LEN) < silenceLevel && DspKernels::peak(signal_r, DMA_BUFFER_LEN) < silenceLevel) {
+      if (quietIn < INT32_MAX - DMA_BUFFER_LEN) quietIn += DMA_BUFFER_LEN;
+    } else {
+      quietIn = 0;
+    }
+    if (quietIn > delaySamples + DMA_BUFFER_LEN && quietOut >= tailSamples()) {
+      memset(signal_l, 0, DMA_BUFFER_LEN * sizeof(float));
+      memset(signal_r, 0, DMA_BUFFER_LEN * sizeof(float));
+      ++skippedBlocks;
+      return;
+    }
+    float outPeak = 0.0f;
+#endif
     for (int n = 0; n < DMA_BUFFER_LEN; ++n) {
       float inSample = 0.5f * (signal_l[n] + signal_r[n]);
 
@@ -131,7 +226,17 @@ public:
 
       signal_l[n] = rev_level * wetL;
       signal_r[n] = rev_level * wetR;
+#ifdef SILENCE_THRESHOLD_DB
+      outPeak = fmaxf(outPeak, fmaxf(fabsf(wetL), fabsf(wetR)));
+#endif
     }
+#ifdef SILENCE_THRESHOLD_DB
+    if (outPeak < silenceLevel) {
+      if (quietOut < INT32_MAX - DMA_BUFFER_LEN) quietOut += DMA_BUFFER_LEN;
+    } else {
+      quietOut = 0;
+    }
+#endif
   }
 
   inline void  __attribute__((hot,always_inline)) IRAM_ATTR process(float* signal_l, float* signal_r) {
@@ -168,6 +273,67 @@ private:
   float rev_time = 0.5f;
   float rev_level = 0.5f;
 
+  ReverbSettings settings;
+  float fadeFrom[4] = {};     // rev_time, rev_level, damping, pre-delay samples
+  float fadeTarget[4] = {};
+  int fadeBlocks = 0;
+  int fadeLeft = 0;
+
+  inline void applyTime(float rt) {
+    rev_time = rt;
+    for (int ch = 0; ch < 2; ++ch) {
+      for (int i = 0; i < NUM_COMBS; ++i)
+        combLim[ch][i] = int(rev_time * combSize[ch][i]);
+      for (int i = 0; i < NUM_ALLPASSES; ++i)
+        allpassLim[ch][i] = int(rev_time * allpassSize[ch][i]);
+    }
+  }
+
+  inline void applyDamping(float d) {
+    globalDamping = d < 0.0f ? 0.0f : (d > 1.0f ? 1.0f : d);
+    for (int i = 0; i < NUM_COMBS; ++i) {
+      comb_dampings[i] = globalDamping * comb_damping_coef[i] ;
+    }
+  }
+
+  inline void applyPreDelay(float samples) {
+    delaySamples = int(samples);
+    if (delaySamples >= predelaySize) delaySamples = predelaySize - 1;
+    if (delaySamples < 0) delaySamples = 0;
+    predelayReadOffset = (predelayPtr - delaySamples + predelaySize) % predelaySize;
+  }
+
+  void stepFade() {
+    --fadeLeft;
+    const float t = 1.0f - (float)fadeLeft / (float)fadeBlocks;
+    float v[4];
+    for (int i = 0; i < 4; ++i) v[i] = fadeFrom[i] + (fadeTarget[i] - fadeFrom[i]) * t;
+    if (fadeLeft == 0) memcpy(v, fadeTarget, sizeof(v));
+    applyTime(v[0]);
+    rev_level = v[1];
+    applyDamping(v[2]);
+    applyPreDelay(v[3]);
+  }
+
+  // silence detection, see processBlock()
+  float silenceLevel = 0.0f;
+  int32_t quietIn = 0;      // samples in a row
+  int32_t quietOut = 0;
+  uint32_t blocks = 0;
+  uint32_t skippedBlocks = 0;
+
+  // samples until whatever is in the combs and allpasses now has reached the output
+  inline int32_t tailSamples() const {
+    int32_t n = 0;
+    for (int ch = 0; ch < 2; ++ch) {
+      int32_t c = 0;
+      for (int i = 0; i < NUM_COMBS; ++i) c = (combLim[ch][i] > c) ? combLim[ch][i] : c;
+      for (int i = 0; i < NUM_ALLPASSES; ++i) c += allpassLim[ch][i];
+      n = (c > n) ? c : n;
+    }
+    return n;
+  }
+
   float* combBuf[2][NUM_COMBS] = {};
   int combSize[2][NUM_COMBS] = {};
   int combPtr[2][NUM_COMBS] = {};
@@ -5,6 +5,8 @@
 #include "i2s_in_out.h"
 #include "esp_log.h"
 #include "esp_task_wdt.h" 
+#include "dsp_kernels.h"
+#include "RenderProfiler.h"
 static const char* TAG = "I2SAUDIO";
 
 /*
@@ -20,7 +22,8 @@ static const char* TAG = "I2SAUDIO";
 */
 
 BUF_TYPE* I2S_Audio::allocateBuffer(const char* name) {
-    BUF_TYPE* buf = (BUF_TYPE*)heap_caps_calloc(16, _buffer_size, _malloc_caps);
+    // 16-byte aligned for the DspKernels PIE path
+    BUF_TYPE* buf = (BUF_TYPE*)heap_caps_aligned_calloc(16, 1, _buffer_size, _malloc_caps);
     if (!buf) {
         ESP_LOGE(TAG, "Couldn't allocate memory for %s buffer", name);
     } else {
@@ -257,17 +260,9 @@ void I2S_Audio::putSamples(float& sampleLeft, float& sampleRight, BUF_TYPE* buf
 void I2S_Audio::writeBuffers(float* L, float* R) {
     if (!_output_buf) return;
 
-    for (int i = 0; i < DMA_BUFFER_LEN; ++i) {
-        int16_t l = convertOutSample(L[i]);
-        int16_t r = convertOutSample(R[i]);
-
-#if CHANNEL_SAMPLE_BYTES == 4
-        _output_buf[i] = (uint16_t)l | ((uint32_t)(uint16_t)r << 16);
-#else
-        _output_buf[2 * i + 0] = l;
-        _output_buf[2 * i + 1] = r;
-#endif
-    }
+    // both layouts are one 32-bit word per frame, L in the low half
+    DspKernels::toI16Stereo((uint32_t*)_output_buf, L, R, float_to_int, DMA_BUFFER_LEN);
+    PROFILE_STAGE(OUTPUT);
 
 #ifdef USE_V3  
     size_t bytes_written = 0;
@@ -276,5 +271,6 @@ void I2S_Audio::writeBuffers(float* L, float* R) {
     size_t bytes_written = 0;
     i2s_write(_i2s_num, _output_buf, _buffer_size, &bytes_written, portMAX_DELAY);
 #endif
+    PROFILE_STAGE(I2S_WAIT);
 }
 
@@ -7,7 +7,7 @@
 
 #pragma once
 
-#include <Arduino.h>
+#include "platform.h"
 #include "config.h"
 #include <cstring>
 
@@ -84,6 +84,7 @@ inline float __attribute__((always_inline)) IRAM_ATTR fast_semitones2speed(float
 // multiply by a reciprocal works ~2x faster than a float division though it can provide less accuracy
 
 inline float __attribute__((always_inline)) IRAM_ATTR one_div(float a) {
+#if defined(__XTENSA__)
  float result;
  asm volatile (
  "wfr f1, %1" "\n\t"
@@ -100,11 +101,15 @@ inline float __attribute__((always_inline)) IRAM_ATTR one_div(float a) {
  : "f0","f1","f2"
  );
  return result;
+#else
+ return 1.0f / a;
+#endif
 }
 
 
 // this float division works faster compared to the "/" operator.. dunno why
 inline float __attribute__((always_inline)) IRAM_ATTR fdiv(float a, float b) {
+#if defined(__XTENSA__)
  float result;
  asm volatile (
  "wfr f0, %1\n"
@@ -138,6 +143,9 @@ inline float __attribute__((always_inline)) IRAM_ATTR fdiv(float a, float b) {
  :"=r"(result):"r"(a), "r"(b)
  );
  return result;
+#else
+ return a / b;
+#endif
 }
 
 inline int __attribute__((always_inline)) IRAM_ATTR strpos(char *hay, char *needle, int offset) {
@@ -186,13 +194,31 @@ inline float __attribute__((always_inline)) IRAM_ATTR lookupTable(const float (&
 #if defined(USE_SIN_LUT)
 static float DRAM_ATTR sin_tbl[TABLE_SIZE + 1] __attribute__((aligned(16)));
 
+#ifdef FIXED_POINT_ENGINE
+static int32_t DRAM_ATTR sin_tbl_q30[TABLE_SIZE + 1] __attribute__((aligned(16)));
+#endif
+
 // Initialize LUT in setup()
 inline void init_sin_tbl() {
   for (int i = 0; i <= TABLE_SIZE; i++) {
     sin_tbl[i] = sinf(TWOPI * i / TABLE_SIZE);
+#ifdef FIXED_POINT_ENGINE
+    sin_tbl_q30[i] = (int32_t)lrint(1073741824.0 * sin(2.0 * M_PI * i / TABLE_SIZE));
+#endif
   }
 }
 
+#ifdef FIXED_POINT_ENGINE
+// Q30 sine of a 32-bit phase (2^32 = one turn): the top TABLE_BIT bits index the
+// table, the next 16 interpolate
+inline int32_t __attribute__((always_inline)) IRAM_ATTR sin_q30(uint32_t phase) {
+ const uint32_t i = phase >> (32 - TABLE_BIT);
+ const int32_t f = (int32_t)((phase >> (16 - TABLE_BIT)) & 0xFFFF);
+ const int32_t a = sin_tbl_q30[i];
+ return a + (int32_t)(((int64_t)(sin_tbl_q30[i + 1] - a) * f) >> 16);
+}
+#endif
+
 inline float __attribute__((always_inline)) IRAM_ATTR fast_sin(const float x) {
  const float argument = x * ONE_DIV_TWOPI * TABLE_SIZE;
  const float res = lookupTable(sin_tbl, CYCLE_INDEX(argument)+((float)argument-(int32_t)argument));
@@ -218,6 +244,29 @@ inline float __attribute__((always_inline)) IRAM_ATTR sin_lut(const float x_norm
  return res;
 }
 
+// sine of a 32-bit phase (2^32 = one turn): the top TABLE_BIT bits index the table,
+// the next 24 - TABLE_BIT interpolate; no float wrap-around needed
+inline float __attribute__((always_inline)) IRAM_ATTR sin_lut_u32(uint32_t phase) {
+ const uint32_t i = phase >> (32 - TABLE_BIT);
+ const float f = (float)((phase >> 8) & ((1UL << (24 - TABLE_BIT)) - 1)) * (1.0f / (float)(1UL << (24 - TABLE_BIT)));
+ const float a = sin_tbl[i];
+ return a + (sin_tbl[i + 1] - a) * f;
+}
+
+#ifdef FIXED_POINT_ENGINE
+// float -> Q31, saturated to [-1, 1)
+inline int32_t __attribute__((always_inline)) IRAM_ATTR q31_sat(float x) {
+ if (x >= 1.0f) return INT32_MAX;
+ if (x <= -1.0f) return INT32_MIN;
+ return (int32_t)(x * 2147483648.0f);
+}
+
+// a * b, b in Q31; the result keeps the format of a
+inline int32_t __attribute__((always_inline)) IRAM_ATTR mul_q31(int32_t a, int32_t b) {
+ return (int32_t)(((int64_t)a * b) >> 31);
+}
+#endif
+
 // norm_x belongs to [0..1], returns sin(alpha) curve for alpha [-pi/2 .. pi/2] normalized to [0..1]
 inline float  __attribute__((always_inline)) IRAM_ATTR sin_fadein(float norm_x) {
  return -0.5f * lookupTable(sin_tbl, HALF_TABLE * norm_x + QUARTER_TABLE) + 0.5f;
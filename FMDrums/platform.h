@@ -0,0 +1,79 @@
+/*
+* Platform shim
+* On the ESP32 it just pulls in Arduino.h. Anywhere else (host build, see /host)
+* it provides the handful of ESP-IDF/Arduino symbols the DSP core relies on,
+* so that FmDrumSynth and friends can be compiled and profiled on a PC.
+*
+* Author: Evgeny Aslovskiy AKA Copych
+* License: MIT
+*/
+
+#pragma once
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+
+#else // host build
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define MALLOC_CAP_EXEC       (1 << 0)
+#define MALLOC_CAP_32BIT      (1 << 1)
+#define MALLOC_CAP_8BIT       (1 << 2)
+#define MALLOC_CAP_DMA        (1 << 3)
+#define MALLOC_CAP_SPIRAM     (1 << 10)
+#define MALLOC_CAP_INTERNAL   (1 << 11)
+#define MALLOC_CAP_DEFAULT    (1 << 12)
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do {} while (0)
+#define ESP_LOGD(tag, fmt, ...) do {} while (0)
+#define ESP_LOGV(tag, fmt, ...) do {} while (0)
+
+using String = std::string;
+
+inline void* heap_caps_malloc(size_t size, uint32_t caps) { (void)caps; return malloc(size); }
+inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) { (void)caps; return calloc(n, size); }
+inline void  heap_caps_free(void* ptr) { free(ptr); }
+
+inline void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    (void)caps;
+    void* p = nullptr;
+    if (alignment < sizeof(void*)) alignment = sizeof(void*);
+    return (posix_memalign(&p, alignment, size) == 0) ? p : nullptr;
+}
+
+inline unsigned long micros() {
+    static const auto t0 = std::chrono::steady_clock::now();
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+// cycle counter stand-in for the profiler: one "cycle" per ns at a nominal 1000 MHz
+struct EspClass {
+    uint32_t getCycleCount() {
+        static const auto t0 = std::chrono::steady_clock::now();
+        return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+    }
+};
+inline EspClass ESP;
+
+inline uint32_t getCpuFrequencyMhz() { return 1000; }
+
+template<typename T, typename L, typename H>
+inline T constrain(T x, L lo, H hi) { return (x < lo) ? lo : (x > hi) ? hi : x; }
+
+#endif
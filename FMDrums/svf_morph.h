@@ -43,6 +43,33 @@ public:
         drive_ = preDrive_ * preDrive_ * (1.0f + 2.0f * res_) * 0.3f;
     }
 
+    // Patch-dependent coefficients, precomputed by makeParams() so that
+    // setParams() needs no powf()/fast_sin()
+    struct Params {
+        float fc, res, morph, freq, damp, bandLimit, drive;
+    };
+
+    // same result as init(sampleRate), then setFreqHz(), setResonance() and setMorph()
+    static Params makeParams(float sampleRate, float freqHz, float reso, float morph) {
+        SvfFilter f;
+        f.init(sampleRate);
+        f.setFreqHz(freqHz);
+        f.setResonance(reso);
+        f.setMorph(morph);
+        return { f.fc_, f.res_, f.morph_, f.freq_, f.damp_, f.bandLimit_, f.drive_ };
+    }
+
+    // keeps the sample rate, drive setting and filter state
+    void setParams(const Params& p) {
+        fc_ = p.fc;
+        res_ = p.res;
+        morph_ = p.morph;
+        freq_ = p.freq;
+        damp_ = p.damp;
+        bandLimit_ = p.bandLimit;
+        drive_ = p.drive;
+    }
+
     inline float getFreqHz()    const { return fc_; }
     inline float getResonance() const { return res_; }
     inline float getDrive()     const { return preDrive_; }
@@ -82,6 +109,29 @@ public:
         return mixed * 1.2f; // Empirical output gain
     }
 
+    // processMorph() over a block, in place, with the output scaled by gain;
+    // state is kept in registers for the whole block
+    inline void processMorphBlock(float* buf, int n, float gain) {
+        float low = low_, band = band_, hp = high_;
+        const float freq = freq_, damp = damp_, drive = drive_, lim = bandLimit_;
+        float wA, wB;
+        const bool lowBand = (morph_ <= 0.5f);
+        if (lowBand) { float t = morph_ * 2.0f;          wA = 1.0f - t; wB = t; }
+        else         { float t = (morph_ - 0.5f) * 2.0f; wA = 1.0f - t; wB = t; }
+        for (int i = 0; i < n; ++i) {
+            float notch = buf[i] - damp * band;
+            hp = notch - low;
+            float bp = fclamp(band + freq * hp, -lim, lim);
+            bp -= drive * bp * fabsf(bp);
+            low = low + freq * bp;
+            band = bp;
+            float mixed = lowBand ? (low * wA + bp * wB) : (bp * wA + hp * wB);
+            buf[i] = gain * (mixed * 1.2f);
+        }
+        low_ = low; band_ = band; high_ = hp;
+        outLow_ = low; outBand_ = band; outHigh_ = hp;
+    }
+
     float getLow()  const { return outLow_; }
     float getBand() const { return outBand_; }
     float getHigh() const { return outHigh_; }
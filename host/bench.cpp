@@ -0,0 +1,37 @@
+/*
+* fmdrums_bench - host runner for VoiceBench
+*
+* usage: fmdrums_bench [blocks]
+* Prints the per-algorithm / per-waveform cost table of FmVoice6::process().
+* Host timings are only comparable with each other; run the same table on
+* the board with TASK_BENCHMARKING defined for absolute numbers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FmDrumSynth.h"
+#include "VoiceBench.h"
+
+alignas(16) float sendL[DMA_BUFFER_LEN];
+alignas(16) float sendR[DMA_BUFFER_LEN];
+
+static void printLine(const char* s) { fputs(s, stdout); }
+
+int main(int argc, char** argv) {
+    int blocks = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (blocks <= 0) {
+        fprintf(stderr, "usage: fmdrums_bench [blocks]\n");
+        return 1;
+    }
+
+    init_sin_tbl();
+    DspKernels::init();
+    printf("DSP kernels: %s\n", DspKernels::implName());
+
+    static FxReverb reverb;
+    reverb.init();
+    static VoiceBench::Result res;
+    VoiceBench::run(res, printLine, blocks, &reverb);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+* Binary drumkit (.fmk) reader and writer for the host build, see
+* ../FMDrums/KitFormat.h. The host is little-endian like the ESP32-S3 and
+* lays FmDrumPatch out the same way (KitFormat checks the record size), so
+* a .fmk written here loads on the board and vice versa. The journal of
+* edits the board keeps next to a kit (.fmj) is replayed the same way.
+*/
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include "KitFormat.h"
+#include "kit_json.h"
+
+namespace HostKit {
+
+// mirrors DrumkitStorage::saveDrumkitBinary(): a record packed if that loses nothing
+template<class Reverb>
+inline bool saveDrumkitBinary(const char* path, const FmDrumPatch patches[128], const Reverb& reverb,
+                              uint32_t generation = 0) {
+    uint8_t index[KitFormat::NumPatches], first[KitFormat::NumPatches];
+    const int n = KitFormat::buildIndex(patches, index, first);
+    uint8_t mask[KitFormat::MaskSize] = {};
+    std::string records;
+    for (int k = 0; k < n; ++k) {
+        PackedPatch packed;
+        if (packPatch(patches[first[k]], packed)) {
+            mask[k >> 3] |= 1 << (k & 7);
+            records.append((const char*)&packed, sizeof(packed));
+        } else {
+            records.append((const char*)&patches[first[k]], sizeof(FmDrumPatch));
+        }
+    }
+    uint32_t crc = KitFormat::crc32(index, KitFormat::IndexSize);
+    crc = KitFormat::crc32(records.data(), records.size(), crc);
+    crc = KitFormat::crc32(mask, KitFormat::MaskSize, crc);
+    KitFormat::Header h = KitFormat::makeHeader(n, crc, reverb.getTime(), reverb.getLevel(),
+                                                reverb.getDamping(), reverb.getPreDelayTime(), generation);
+    std::ofstream f(path, std::ios::binary);
+    if (!f) return false;
+    f.write((const char*)&h, sizeof(h));
+    f.write((const char*)index, KitFormat::IndexSize);
+    f.write((const char*)mask, KitFormat::MaskSize);
+    f.write(records.data(), records.size());
+    return (bool)f;
+}
+
+// mirrors DrumkitStorage::loadDrumkitBinary(): patches[] stays as it was on a bad file
+template<class Reverb>
+inline bool loadDrumkitBinary(const char* path, FmDrumPatch patches[128], Reverb& reverb,
+                              uint32_t* generation = nullptr) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+
+    uint8_t raw[sizeof(KitFormat::Header)];
+    f.read((char*)raw, sizeof(raw));
+    KitFormat::Header h;
+    if (!KitFormat::readHeader(raw, (size_t)f.gcount(), h)) {
+        fprintf(stderr, "%s is not a version %d kit of this build\n", path, KitFormat::Version);
+        return false;
+    }
+    f.clear();
+    f.seekg(h.headerSize);
+    const size_t indexSize = KitFormat::hasIndex(h) ? KitFormat::IndexSize : 0;
+    const size_t maskSize = KitFormat::hasMask(h) ? KitFormat::MaskSize : 0;
+    uint8_t index[KitFormat::NumPatches];
+    uint8_t mask[KitFormat::MaskSize] = {};         // before version 3: all float records
+    for (int i = 0; i < 128; ++i) index[i] = i;     // version 1: all 128
+    if (!f.read((char*)index, indexSize) || !f.read((char*)mask, maskSize) ||
+        !KitFormat::checkIndex(index, h.numPatches)) {
+        fprintf(stderr, "%s is damaged\n", path);
+        return false;
+    }
+    std::vector<FmDrumPatch> table(KitFormat::NumPatches);
+    const size_t recordSize = KitFormat::recordBytes(h.numPatches, mask);
+    uint8_t* top = (uint8_t*)table.data() + KitFormat::TableSize - recordSize;
+    uint32_t crc = KitFormat::crc32(index, indexSize);
+    if (!f.read((char*)top, recordSize) ||
+        KitFormat::crc32(mask, maskSize, KitFormat::crc32(top, recordSize, crc)) != h.patchCrc) {
+        fprintf(stderr, "%s is damaged\n", path);
+        return false;
+    }
+    KitFormat::decodeRecords(table.data(), h.numPatches, mask);
+    KitFormat::expandTable(table.data(), index);
+    for (int i = 0; i < 128; ++i) {
+        patches[i] = table[i];
+        patches[i].name[sizeof(patches[i].name) - 1] = '\0';
+    }
+
+    reverb.setTime(h.reverbTime);
+    reverb.setLevel(h.reverbLevel);
+    reverb.setDamping(h.reverbDamp);
+    reverb.setPreDelayTime(h.reverbPreDelay);
+    if (generation) *generation = h.generation;
+    return true;
+}
+
+// mirrors DrumkitStorage::replayJournal(): the number of records applied, -1 if
+// the journal is not one of the kit file of that generation
+template<class Reverb>
+inline int replayJournal(const char* path, uint32_t generation, FmDrumPatch patches[128], Reverb& reverb) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return 0;
+
+    KitFormat::JournalHeader h;
+    if (!f.read((char*)&h, sizeof(h)) || !KitFormat::checkJournalHeader(h)) {
+        fprintf(stderr, "%s is not a version %d journal of this build\n", path, KitFormat::JournalVersion);
+        return -1;
+    }
+    if (h.generation != generation) {
+        fprintf(stderr, "%s is of kit generation %u, the kit file is %u\n", path, (unsigned)h.generation,
+                (unsigned)generation);
+        return -1;
+    }
+    int applied = 0;
+    KitFormat::JournalRecord r;
+    while (f.read((char*)&r, sizeof(r))) {
+        if (r.crc != KitFormat::recordCrc(r)) {
+            fprintf(stderr, "%s: record %d is damaged, the rest is dropped\n", path, applied);
+            break;
+        }
+        if (r.kind == KitFormat::PatchRecord && r.note < 128) {
+            memcpy(&patches[r.note], r.payload, sizeof(FmDrumPatch));
+            patches[r.note].name[sizeof(patches[r.note].name) - 1] = '\0';
+        } else if (r.kind == KitFormat::ReverbRecord) {
+            float s[4];
+            memcpy(s, r.payload, sizeof(s));
+            reverb.setTime(s[0]);
+            reverb.setLevel(s[1]);
+            reverb.setDamping(s[2]);
+            reverb.setPreDelayTime(s[3]);
+        }
+        ++applied;
+    }
+    return applied;
+}
+
+// by extension: *.fmk binary, with its .fmj replayed if there is one of the same
+// generation (left alone otherwise, the board deletes it); anything else JSON
+template<class Reverb>
+inline bool loadDrumkit(const char* path, FmDrumPatch patches[128], Reverb& reverb) {
+    if (!KitFormat::hasExtension(path)) return loadDrumkitJson(path, patches, reverb);
+    uint32_t generation = 0;
+    if (!loadDrumkitBinary(path, patches, reverb, &generation)) return false;
+    std::string journal(path);
+    journal.replace(journal.size() - strlen(KitFormat::Extension), std::string::npos, KitFormat::JournalExtension);
+    if (std::ifstream(journal)) {
+        int n = replayJournal(journal.c_str(), generation, patches, reverb);
+        if (n >= 0) fprintf(stderr, "Replayed %d edits from %s\n", n, journal.c_str());
+        else        fprintf(stderr, "Skipped %s\n", journal.c_str());
+    }
+    return true;
+}
+
+template<class Reverb>
+inline bool saveDrumkit(const char* path, const FmDrumPatch patches[128], const Reverb& reverb) {
+    return KitFormat::hasExtension(path) ? saveDrumkitBinary(path, patches, reverb)
+                                         : saveDrumkitJson(path, patches, reverb);
+}
+
+} // namespace HostKit
@@ -0,0 +1,298 @@
+/*
+* Minimal drumkit JSON reader and writer for the host build.
+* Understands exactly the layout written by DrumkitStorage::saveDrumkitJson()
+* (same keys, same defaults), so no ArduinoJson is required on the PC.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include "FmPatch.h"
+
+namespace HostKit {
+
+struct JsonValue {
+    enum Type { Null, Number, String, Array, Object } type = Null;
+    double num = 0.0;
+    std::string str;
+    std::vector<JsonValue> arr;
+    std::map<std::string, JsonValue> obj;
+
+    bool has(const char* key) const { return type == Object && obj.count(key) > 0; }
+
+    float f(const char* key, float def) const {
+        auto it = obj.find(key);
+        return (it != obj.end() && it->second.type == Number) ? (float)it->second.num : def;
+    }
+
+    int i(const char* key, int def) const {
+        auto it = obj.find(key);
+        return (it != obj.end() && it->second.type == Number) ? (int)it->second.num : def;
+    }
+
+    const char* s(const char* key, const char* def) const {
+        auto it = obj.find(key);
+        return (it != obj.end() && it->second.type == String) ? it->second.str.c_str() : def;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : p_(text.c_str()), end_(text.c_str() + text.size()) {}
+
+    bool parse(JsonValue& out) {
+        ok_ = true;
+        value(out);
+        ws();
+        return ok_ && p_ == end_;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+    bool ok_ = true;
+
+    void ws() { while (p_ < end_ && isspace((unsigned char)*p_)) ++p_; }
+
+    bool expect(char c) {
+        ws();
+        if (p_ < end_ && *p_ == c) { ++p_; return true; }
+        ok_ = false;
+        return false;
+    }
+
+    void value(JsonValue& v) {
+        ws();
+        if (p_ >= end_) { ok_ = false; return; }
+        switch (*p_) {
+            case '{': object(v); break;
+            case '[': array(v); break;
+            case '"': v.type = JsonValue::String; string(v.str); break;
+            case 't': v.type = JsonValue::Number; v.num = 1.0; literal("true"); break;
+            case 'f': v.type = JsonValue::Number; v.num = 0.0; literal("false"); break;
+            case 'n': v.type = JsonValue::Null; literal("null"); break;
+            default: {
+                char* e = nullptr;
+                v.type = JsonValue::Number;
+                v.num = strtod(p_, &e);
+                if (e == p_) ok_ = false;
+                p_ = e;
+            }
+        }
+    }
+
+    void literal(const char* lit) {
+        size_t n = strlen(lit);
+        if ((size_t)(end_ - p_) >= n && strncmp(p_, lit, n) == 0) p_ += n;
+        else ok_ = false;
+    }
+
+    void string(std::string& out) {
+        if (!expect('"')) return;
+        while (p_ < end_ && *p_ != '"') {
+            if (*p_ == '\\' && p_ + 1 < end_) {
+                ++p_;
+                switch (*p_) {
+                    case 'n': out += '\n'; break;
+                    case 't': out += '\t'; break;
+                    case 'u': out += '?'; p_ += 4; break; // names are plain ASCII
+                    default:  out += *p_;
+                }
+                ++p_;
+            } else {
+                out += *p_++;
+            }
+        }
+        expect('"');
+    }
+
+    void array(JsonValue& v) {
+        v.type = JsonValue::Array;
+        expect('[');
+        ws();
+        if (p_ < end_ && *p_ == ']') { ++p_; return; }
+        while (ok_) {
+            v.arr.emplace_back();
+            value(v.arr.back());
+            ws();
+            if (p_ < end_ && *p_ == ',') { ++p_; continue; }
+            expect(']');
+            return;
+        }
+    }
+
+    void object(JsonValue& v) {
+        v.type = JsonValue::Object;
+        expect('{');
+        ws();
+        if (p_ < end_ && *p_ == '}') { ++p_; return; }
+        while (ok_) {
+            std::string key;
+            ws();
+            string(key);
+            if (!expect(':')) return;
+            value(v.obj[key]);
+            ws();
+            if (p_ < end_ && *p_ == ',') { ++p_; continue; }
+            expect('}');
+            return;
+        }
+    }
+};
+
+// mirrors DrumkitStorage::deserializePatch()
+inline void deserializePatch(const JsonValue& obj, FmDrumPatch& patch) {
+    strncpy(patch.name, obj.s("name", ""), sizeof(patch.name) - 1);
+    patch.name[sizeof(patch.name) - 1] = '\0';
+
+    patch.algoIndex = obj.i("alg", 0);
+    patch.chokeGroup = obj.i("grp", 0);
+    patch.baseFreq = obj.f("freq", 440.0f);
+    patch.velocityMod = obj.f("veloMod", 0.5f);
+    patch.volume = obj.f("vol", 1.0f);
+    patch.pan = obj.f("pan", 0.0f);
+    patch.reverbSend = obj.f("rvb", 0.1f);
+
+    patch.attack  = obj.f("atk", 0.01f);
+    patch.hold    = obj.f("hold", 0.01f);
+    patch.decay   = obj.f("dec", 0.2f);
+    patch.sustain = obj.f("sus", 0.0f);
+    patch.release = obj.f("rel", 0.1f);
+
+    patch.useFilter = obj.i("flt", 0);
+
+    patch.filterFreqHz = obj.f("filterFreq", 16000.0f);
+    patch.filterReso = obj.f("filterReso", 0.5f);
+    patch.filterMorph = obj.f("filterMorph", 0.0f);
+
+    static const JsonValue empty;
+    const JsonValue* ops = obj.has("ops") ? &obj.obj.at("ops") : &empty;
+    for (int i = 0; i < 6; ++i) {
+        const JsonValue& op = (ops->type == JsonValue::Array && i < (int)ops->arr.size()) ? ops->arr[i] : empty;
+        patch.ops[i].ratio    = op.f("ratio", 1.0f);
+        patch.ops[i].detune   = op.f("detune", 0.0f);
+        patch.ops[i].feedback = op.f("fb", 0.0f);
+        patch.ops[i].volume   = op.f("vol", 0.8f);
+        patch.ops[i].waveform = Waveform(op.i("wave", 0));
+    }
+}
+
+// mirrors DrumkitStorage::loadDrumkitJson()
+template<class Reverb>
+inline bool loadDrumkitJson(const char* path, FmDrumPatch patches[128], Reverb& reverb) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    std::stringstream ss;
+    ss << f.rdbuf();
+
+    JsonValue root;
+    if (!JsonParser(ss.str()).parse(root) || root.type != JsonValue::Object) return false;
+    if (!root.has("patches")) return false;
+    const JsonValue& arr = root.obj.at("patches");
+    if (arr.type != JsonValue::Array || arr.arr.size() < 128) return false;
+
+    for (int i = 0; i < 128; ++i)
+        deserializePatch(arr.arr[i], patches[i]);
+
+    if (root.has("reverbTime"))     reverb.setTime(root.f("reverbTime", 0.8f));
+    if (root.has("reverbLevel"))    reverb.setLevel(root.f("reverbLevel", 0.5f));
+    if (root.has("reverbDamp"))     reverb.setDamping(root.f("reverbDamp", 0.6f));
+    if (root.has("reverbPreDelay")) reverb.setPreDelayTime(root.f("reverbPreDelay", 10.0f));
+
+    return true;
+}
+
+
+// the shortest decimal that reads back as the same float
+inline std::string number(float v) {
+    char buf[32];
+    for (int digits = 6; digits <= 9; ++digits) {
+        snprintf(buf, sizeof(buf), "%.*g", digits, (double)v);
+        if (strtof(buf, nullptr) == v) break;
+    }
+    return buf;
+}
+
+inline std::string quoted(const char* s) {
+    std::string out = "\"";
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out + "\"";
+}
+
+// mirrors DrumkitStorage::serializePatch(), indented like serializeJsonPretty()
+inline void serializePatch(std::ostream& out, const FmDrumPatch& patch, const char* indent) {
+    const std::string in1 = std::string(indent) + "  ";
+    const std::string in2 = in1 + "  ";
+    const std::string in3 = in2 + "  ";
+    out << indent << "{\n"
+        << in1 << "\"name\": " << quoted(patch.name) << ",\n"
+        << in1 << "\"alg\": " << (int)patch.algoIndex << ",\n"
+        << in1 << "\"grp\": " << (int)patch.chokeGroup << ",\n"
+        << in1 << "\"freq\": " << number(patch.baseFreq) << ",\n"
+        << in1 << "\"veloMod\": " << number(patch.velocityMod) << ",\n"
+        << in1 << "\"vol\": " << number(patch.volume) << ",\n"
+        << in1 << "\"pan\": " << number(patch.pan) << ",\n"
+        << in1 << "\"rvb\": " << number(patch.reverbSend) << ",\n"
+        << in1 << "\"atk\": " << number(patch.attack) << ",\n"
+        << in1 << "\"hold\": " << number(patch.hold) << ",\n"
+        << in1 << "\"dec\": " << number(patch.decay) << ",\n"
+        << in1 << "\"sus\": " << number(patch.sustain) << ",\n"
+        << in1 << "\"rel\": " << number(patch.release) << ",\n"
+        << in1 << "\"flt\": " << (int)patch.useFilter << ",\n"
+        << in1 << "\"filterFreq\": " << number(patch.filterFreqHz) << ",\n"
+        << in1 << "\"filterReso\": " << number(patch.filterReso) << ",\n"
+        << in1 << "\"filterMorph\": " << number(patch.filterMorph) << ",\n"
+        << in1 << "\"ops\": [\n";
+    for (int i = 0; i < 6; ++i) {
+        const FmOpParams& op = patch.ops[i];
+        out << in2 << "{\n"
+            << in3 << "\"ratio\": " << number(op.ratio) << ",\n"
+            << in3 << "\"detune\": " << number(op.detune) << ",\n"
+            << in3 << "\"fb\": " << number(op.feedback) << ",\n"
+            << in3 << "\"vol\": " << number(op.volume) << ",\n"
+            << in3 << "\"wave\": " << static_cast<int>(op.waveform.value) << "\n"
+            << in2 << (i < 5 ? "},\n" : "}\n");
+    }
+    out << in1 << "]\n" << indent << "}";
+}
+
+// mirrors DrumkitStorage::saveDrumkitJson()
+template<class Reverb>
+inline bool saveDrumkitJson(const char* path, const FmDrumPatch patches[128], const Reverb& reverb) {
+    std::ofstream f(path, std::ios::binary);
+    if (!f) return false;
+    f << "{\n"
+      << "  \"reverbTime\": " << number(reverb.getTime()) << ",\n"
+      << "  \"reverbLevel\": " << number(reverb.getLevel()) << ",\n"
+      << "  \"reverbDamp\": " << number(reverb.getDamping()) << ",\n"
+      << "  \"reverbPreDelay\": " << number(reverb.getPreDelayTime()) << ",\n"
+      << "  \"patches\": [\n";
+    for (int i = 0; i < 128; ++i) {
+        serializePatch(f, patches[i], "    ");
+        f << (i < 127 ? ",\n" : "\n");
+    }
+    f << "  ]\n}";
+    return (bool)f;
+}
+
+} // namespace HostKit
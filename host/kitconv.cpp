@@ -0,0 +1,33 @@
+/*
+* fmdrums_kitconv - converts drumkits between JSON and the binary .fmk format
+*
+* usage: fmdrums_kitconv <in.json | in.fmk> <out.json | out.fmk>
+*        the format of each file is taken from its extension
+*
+* Patches and reverb settings are copied as they are, so JSON -> .fmk -> JSON
+* gives back the same values.
+*/
+
+#include <stdio.h>
+#include "fx_reverb.h"
+#include "kit_fmk.h"
+
+static FmDrumPatch patches[128];
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: fmdrums_kitconv <in.json | in.fmk> <out.json | out.fmk>\n");
+        return 1;
+    }
+    ReverbSettings reverb;
+    if (!HostKit::loadDrumkit(argv[1], patches, reverb)) {
+        fprintf(stderr, "Failed to load drumkit '%s'\n", argv[1]);
+        return 2;
+    }
+    if (!HostKit::saveDrumkit(argv[2], patches, reverb)) {
+        fprintf(stderr, "Failed to write '%s'\n", argv[2]);
+        return 2;
+    }
+    printf("%s -> %s\n", argv[1], argv[2]);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+* Standard MIDI File reader for the host build.
+* Formats 0 and 1, all tracks merged, tempo map applied.
+* Only note on/off are kept: that is all FmDrumSynth reacts to.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+namespace HostMidi {
+
+struct NoteEvent {
+    uint64_t sample;    // absolute position in samples
+    uint8_t  note;
+    uint8_t  velocity;  // 0 = note off
+};
+
+class MidiFile {
+public:
+    bool load(const char* path, float sampleRate) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return false;
+        data_.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        pos_ = 0;
+        events_.clear();
+
+        if (!tag("MThd") || be32() != 6) return false;
+        uint16_t format = be16();
+        uint16_t numTracks = be16();
+        division_ = be16();
+        if (format > 1 || (division_ & 0x8000)) return false; // SMPTE timing is not supported
+
+        std::vector<Raw> raw;
+        for (int t = 0; t < numTracks; ++t) {
+            if (!tag("MTrk")) return false;
+            size_t len = be32();
+            size_t end = pos_ + len;
+            if (end > data_.size()) return false;
+            readTrack(end, raw);
+            pos_ = end;
+        }
+
+        // tempo events must precede notes sharing the same tick
+        std::stable_sort(raw.begin(), raw.end(), [](const Raw& a, const Raw& b) {
+            return a.tick != b.tick ? a.tick < b.tick : a.isTempo > b.isTempo;
+        });
+
+        double usPerQuarter = 500000.0;
+        double seconds = 0.0;
+        uint64_t lastTick = 0;
+        for (const auto& r : raw) {
+            seconds += (double)(r.tick - lastTick) * usPerQuarter * 1e-6 / division_;
+            lastTick = r.tick;
+            if (r.isTempo) {
+                usPerQuarter = r.tempo;
+            } else {
+                events_.push_back({ (uint64_t)(seconds * sampleRate + 0.5), r.note, r.velocity });
+            }
+        }
+        lengthSamples_ = (uint64_t)(seconds * sampleRate + 0.5);
+        return true;
+    }
+
+    const std::vector<NoteEvent>& events() const { return events_; }
+    uint64_t lengthSamples() const { return lengthSamples_; }
+
+private:
+    struct Raw {
+        uint64_t tick;
+        bool     isTempo;
+        uint32_t tempo;
+        uint8_t  note;
+        uint8_t  velocity;
+    };
+
+    std::vector<uint8_t> data_;
+    size_t pos_ = 0;
+    uint16_t division_ = 96;
+    std::vector<NoteEvent> events_;
+    uint64_t lengthSamples_ = 0;
+
+    uint8_t  u8()   { return pos_ < data_.size() ? data_[pos_++] : 0; }
+    uint16_t be16() { uint16_t v = u8() << 8; return v | u8(); }
+    uint32_t be32() { uint32_t v = be16() << 16; return v | be16(); }
+
+    uint32_t vlq() {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            uint8_t b = u8();
+            v = (v << 7) | (b & 0x7F);
+            if (!(b & 0x80)) break;
+        }
+        return v;
+    }
+
+    bool tag(const char* t) {
+        for (int i = 0; i < 4; ++i) if (u8() != (uint8_t)t[i]) return false;
+        return true;
+    }
+
+    void readTrack(size_t end, std::vector<Raw>& out) {
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        while (pos_ < end) {
+            tick += vlq();
+            uint8_t b = data_[pos_];
+            if (b & 0x80) { status = b; ++pos_; }  // otherwise running status
+
+            if (status == 0xFF) {
+                uint8_t type = u8();
+                uint32_t len = vlq();
+                if (type == 0x51 && len == 3) {
+                    uint32_t t = u8() << 16; t |= u8() << 8; t |= u8();
+                    out.push_back({ tick, true, t, 0, 0 });
+                } else {
+                    pos_ += len;
+                }
+                if (type == 0x2F) return;
+                status = 0;
+                continue;
+            }
+            if (status == 0xF0 || status == 0xF7) {
+                pos_ += vlq();
+                status = 0;
+                continue;
+            }
+
+            uint8_t d1 = u8();
+            uint8_t hi = status & 0xF0;
+            if (hi == 0xC0 || hi == 0xD0) continue;
+            uint8_t d2 = u8();
+            if (hi == 0x90) out.push_back({ tick, false, 0, d1, d2 });
+            else if (hi == 0x80) out.push_back({ tick, false, 0, d1, 0 });
+        }
+    }
+};
+
+} // namespace HostMidi
@@ -0,0 +1,171 @@
+/*
+* fmdrums_render - offline renderer for the host build
+*
+* Plays a Standard MIDI File through FmDrumSynth with a given drumkit
+* and writes a 16-bit stereo WAV. The synth is driven exactly like on the
+* board: note events go through its event queue, stamped with their exact
+* sample position, and renderAudioBlock() is called for every
+* DMA_BUFFER_LEN samples.
+*
+* usage: fmdrums_render [-t tail_sec] [-d] [-r] <kit.json | kit.fmk | -> <song.mid> <out.wav>
+*        "-" instead of a kit uses the built-in fmDrumPatches[] map
+*        -d renders part of the voices on a second thread, like DUAL_CORE_RENDER
+*        -r runs the reverb pipelined on a second thread, like REVERB_PIPELINE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "FmDrumSynth.h"
+#include "kit_fmk.h"
+#include "midi_file.h"
+#include "wav_writer.h"
+
+alignas(16) float sendL[DMA_BUFFER_LEN];
+alignas(16) float sendR[DMA_BUFFER_LEN];
+
+alignas(16) static float outL[DMA_BUFFER_LEN];
+alignas(16) static float outR[DMA_BUFFER_LEN];
+
+static FmDrumSynth synth;
+
+static void usage() {
+    fprintf(stderr, "usage: fmdrums_render [-t tail_sec] [-d] [-r] <kit.json | kit.fmk | -> <song.mid> <out.wav>\n");
+}
+
+int main(int argc, char** argv) {
+    float tailSec = 2.0f;
+    bool dualCore = false;
+    bool reverbPipe = false;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (!strcmp(argv[argi], "-t") && argi + 1 < argc) {
+            tailSec = atof(argv[argi + 1]);
+            argi += 2;
+        } else if (!strcmp(argv[argi], "-d")) {
+            dualCore = true;
+            ++argi;
+        } else if (!strcmp(argv[argi], "-r")) {
+            reverbPipe = true;
+            ++argi;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (argc - argi != 3) {
+        usage();
+        return 1;
+    }
+    const char* kitPath  = argv[argi];
+    const char* midiPath = argv[argi + 1];
+    const char* wavPath  = argv[argi + 2];
+
+    init_sin_tbl();
+    DspKernels::init();
+    synth.init();
+
+    if (strcmp(kitPath, "-") != 0) {
+        DrumKit& kit = synth.beginKit();
+        if (!HostKit::loadDrumkit(kitPath, kit.patches, kit.reverb)) {
+            fprintf(stderr, "Failed to load drumkit '%s'\n", kitPath);
+            return 2;
+        }
+        synth.commitKit(kit);
+    } else {
+        synth.refreshSampleCache();
+    }
+#ifdef SAMPLE_CACHE
+    printf("sample cache: %d one-shots, %u kB\n", synth.getSampleCache().numSamples(),
+           (unsigned)(synth.getSampleCache().bytes() / 1024));
+#endif
+
+    HostMidi::MidiFile midi;
+    if (!midi.load(midiPath, SAMPLE_RATE)) {
+        fprintf(stderr, "Failed to read MIDI file '%s'\n", midiPath);
+        return 2;
+    }
+
+    HostWav::WavWriter wav;
+    if (!wav.open(wavPath, SAMPLE_RATE)) {
+        fprintf(stderr, "Failed to create '%s'\n", wavPath);
+        return 2;
+    }
+
+    // the worker threads just poll, so the kicks have nothing to do
+    std::atomic<bool> quit{false};
+    std::thread worker, reverbWorker;
+    if (dualCore) {
+        synth.attachWorker([]() {});
+        worker = std::thread([&quit]() {
+            while (!quit.load(std::memory_order_relaxed)) {
+                if (!synth.runWorker()) std::this_thread::yield();
+            }
+        });
+    }
+#ifdef REVERB_PIPELINE
+    if (reverbPipe) {
+        synth.attachReverbWorker([]() {});
+        reverbWorker = std::thread([&quit]() {
+            while (!quit.load(std::memory_order_relaxed)) {
+                if (!synth.runReverbWorker()) std::this_thread::yield();
+            }
+        });
+    }
+#else
+    if (reverbPipe) fprintf(stderr, "Built without REVERB_PIPELINE, -r ignored\n");
+#endif
+    if (synth.reverbLatency()) printf("reverb pipelined, wet latency %d samples\n", synth.reverbLatency());
+
+    const auto& events = midi.events();
+    const uint64_t total = midi.lengthSamples() + (uint64_t)(tailSec * SAMPLE_RATE);
+    size_t next = 0;
+    uint64_t blocks = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (uint64_t pos = 0; pos < total; pos += DMA_BUFFER_LEN) {
+        // queue everything due in this block; the synth clock starts at 0 like pos
+        while (next < events.size() && events[next].sample < pos + DMA_BUFFER_LEN) {
+            const auto& ev = events[next];
+            SynthEvent se = { (uint32_t)ev.sample, ev.velocity > 0 ? SynthEvent::NOTE_ON : SynthEvent::NOTE_OFF,
+                              ev.note, ev.velocity };
+            if (!synth.queueEvent(se)) break;  // full: the rest goes in late, next block
+            ++next;
+        }
+        synth.renderAudioBlock(outL, outR);
+        wav.write(outL, outR, DMA_BUFFER_LEN);
+        PROFILE_STAGE(OUTPUT);
+        PROFILE_STAGE(I2S_WAIT);   // nothing to wait for here
+        ++blocks;
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    wav.close();
+    quit = true;
+    if (worker.joinable()) worker.join();
+    if (reverbWorker.joinable()) reverbWorker.join();
+
+    double renderSec = std::chrono::duration<double>(t1 - t0).count();
+    double audioSec = (double)(blocks * DMA_BUFFER_LEN) / SAMPLE_RATE;
+    printf("%zu events, %llu blocks, %.2f s of audio rendered in %.3f s (%.1fx realtime, %.2f us/block)\n",
+           events.size(), (unsigned long long)blocks, audioSec, renderSec,
+           renderSec > 0 ? audioSec / renderSec : 0.0, blocks ? renderSec * 1e6 / blocks : 0.0);
+#ifdef VOICE_COST_BUDGET
+    printf("voice budget: peak %d of %d cost units, %u voices faded out and %u cut to fit\n", synth.getAllocator().peakCost(),
+           VOICE_COST_BUDGET, (unsigned)synth.getAllocator().budgetFades(), (unsigned)synth.getAllocator().budgetCuts());
+#endif
+#ifdef SILENCE_THRESHOLD_DB
+    printf("silence: %u voices ended early, %u of %u reverb blocks skipped\n",
+           (unsigned)synth.getVoicesRetired(), (unsigned)synth.getReverb().getSkippedBlocks(),
+           (unsigned)synth.getReverb().getBlocks());
+#endif
+#ifdef TASK_BENCHMARKING
+    renderProfiler.print([](const char* line) { fputs(line, stdout); });
+#endif
+    return 0;
+}
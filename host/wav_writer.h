@@ -0,0 +1,68 @@
+/*
+* 16-bit stereo PCM WAV writer for the host build.
+* Float samples are converted the same way I2S_Audio::writeBuffers() does,
+* but clipped instead of wrapped.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace HostWav {
+
+class WavWriter {
+public:
+    ~WavWriter() { close(); }
+
+    bool open(const char* path, uint32_t sampleRate) {
+        f_ = fopen(path, "wb");
+        if (!f_) return false;
+        sampleRate_ = sampleRate;
+        frames_ = 0;
+        writeHeader();
+        return true;
+    }
+
+    void write(const float* L, const float* R, int n) {
+        for (int i = 0; i < n; ++i) {
+            int16_t s[2] = { convert(L[i]), convert(R[i]) };
+            fwrite(s, sizeof(s), 1, f_);
+        }
+        frames_ += n;
+    }
+
+    void close() {
+        if (!f_) return;
+        fseek(f_, 0, SEEK_SET);
+        writeHeader();
+        fclose(f_);
+        f_ = nullptr;
+    }
+
+private:
+    FILE* f_ = nullptr;
+    uint32_t sampleRate_ = 44100;
+    uint32_t frames_ = 0;
+
+    static int16_t convert(float smp) {
+        float v = smp * 32767.0f;
+        if (v > 32767.0f) v = 32767.0f;
+        if (v < -32768.0f) v = -32768.0f;
+        return (int16_t)v;
+    }
+
+    void u32(uint32_t v) { fwrite(&v, 4, 1, f_); } // host is little-endian, as is WAV
+    void u16(uint16_t v) { fwrite(&v, 2, 1, f_); }
+
+    void writeHeader() {
+        const uint32_t dataBytes = frames_ * 4;
+        fwrite("RIFF", 1, 4, f_); u32(36 + dataBytes);
+        fwrite("WAVE", 1, 4, f_);
+        fwrite("fmt ", 1, 4, f_); u32(16);
+        u16(1); u16(2); u32(sampleRate_); u32(sampleRate_ * 4); u16(4); u16(16);
+        fwrite("data", 1, 4, f_); u32(dataBytes);
+    }
+};
+
+} // namespace HostWav